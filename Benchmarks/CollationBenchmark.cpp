@@ -0,0 +1,298 @@
+/*
+  ==============================================================================
+
+    Micro-benchmark for the collations in Source/Collation.cpp. It only needs the standard library and
+    that one file, so it builds without JUCE or the rest of the app:
+
+        c++ -std=c++20 -O2 -ISource Benchmarks/CollationBenchmark.cpp Source/Collation.cpp -o collation-benchmark
+        cl /std:c++20 /O2 /EHsc /ISource Benchmarks\CollationBenchmark.cpp Source\Collation.cpp
+
+    Every input comes from a fixed seed, so runs on the same machine are comparable. Each case is timed
+    several times and the fastest run is reported, in nanoseconds per comparison. To compare with an
+    earlier version of the collations, build this file against that revision's Collation.cpp.
+
+    The REVID results are checked against the implementation Collation.cpp replaced before anything is
+    timed, so a faster comparison that orders differently shows up as a failure instead of a win. The
+    JSON collations have no such reference in the tree; their timings are absolute, to be compared
+    between builds.
+
+  ==============================================================================
+*/
+
+#include "Collation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+    //==============================================================================
+    /** The REVID collation as it was before Collation.cpp (CBLCollateRevIDs), kept as the baseline. */
+    auto sgn (int n) -> int
+    {
+        return n > 0 ? 1 : (n < 0 ? -1 : 0);
+    }
+
+    auto defaultCollate (const char* str1, int len1, const char* str2, int len2) -> int
+    {
+        const int result = std::memcmp (str1, str2, static_cast<size_t> (std::min (len1, len2)));
+        return sgn (result ? result : (len1 - len2));
+    }
+
+    auto parseDigits (const char* str, const char* end) -> unsigned
+    {
+        unsigned result = 0;
+        for (; str < end; ++str)
+        {
+            if (*str < '0' || *str > '9')
+                return 0;
+            result = 10 * result + static_cast<unsigned> (*str - '0');
+        }
+        return result;
+    }
+
+    auto referenceCollateRevIDs (std::string_view rev1, std::string_view rev2) -> int
+    {
+        const auto len1 = static_cast<int> (rev1.size());
+        const auto len2 = static_cast<int> (rev2.size());
+        const char* dash1 = static_cast<const char*> (std::memchr (rev1.data(), '-', rev1.size()));
+        const char* dash2 = static_cast<const char*> (std::memchr (rev2.data(), '-', rev2.size()));
+
+        if ((dash1 == rev1.data() + 1 && dash2 == rev2.data() + 1)
+            || dash1 > rev1.data() + 8 || dash2 > rev2.data() + 8
+            || dash1 == nullptr || dash2 == nullptr)
+            return defaultCollate (rev1.data(), len1, rev2.data(), len2);
+
+        const int gen1 = static_cast<int> (parseDigits (rev1.data(), dash1));
+        const int gen2 = static_cast<int> (parseDigits (rev2.data(), dash2));
+        if (! gen1 || ! gen2)
+            return defaultCollate (rev1.data(), len1, rev2.data(), len2);
+
+        const int result = sgn (gen1 - gen2);
+        return result ? result : defaultCollate (dash1 + 1, len1 - static_cast<int> (dash1 + 1 - rev1.data()),
+                                                 dash2 + 1, len2 - static_cast<int> (dash2 + 1 - rev2.data()));
+    }
+
+    //==============================================================================
+    using Collation = std::function<int (std::string_view, std::string_view)>;
+    using Pairs = std::vector<std::pair<std::string_view, std::string_view>>;
+
+    std::mt19937_64 random (20240531);
+
+    auto randomHex (size_t length) -> std::string
+    {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string text (length, '0');
+        for (auto& c : text)
+            c = digits[random() & 15];
+        return text;
+    }
+
+    auto randomRevIds (int count, int maxGeneration) -> std::vector<std::string>
+    {
+        std::vector<std::string> revIds;
+        for (int i = 0; i < count; ++i)
+            revIds.push_back (std::to_string (1 + random() % static_cast<unsigned> (maxGeneration)) + "-" + randomHex (32));
+        return revIds;
+    }
+
+    auto randomPairs (const std::vector<std::string>& values, size_t count) -> Pairs
+    {
+        Pairs pairs;
+        for (size_t i = 0; i < count; ++i)
+            pairs.emplace_back (values[random() % values.size()], values[random() % values.size()]);
+        return pairs;
+    }
+
+    /** Each value against the next one once they are sorted, i.e. the pairs an index lookup compares. */
+    auto neighbourPairs (std::vector<std::string> values, const Collation& collation) -> std::vector<std::pair<std::string, std::string>>
+    {
+        std::sort (values.begin(), values.end(), [&] (const std::string& a, const std::string& b) { return collation (a, b) < 0; });
+
+        std::vector<std::pair<std::string, std::string>> pairs;
+        for (size_t i = 1; i < values.size(); ++i)
+            pairs.emplace_back (values[i - 1], values[i]);
+        return pairs;
+    }
+
+    auto toPairs (const std::vector<std::pair<std::string, std::string>>& owned) -> Pairs
+    {
+        Pairs pairs;
+        for (auto& [a, b] : owned)
+            pairs.emplace_back (a, b);
+        return pairs;
+    }
+
+    //==============================================================================
+    int failures = 0;
+
+    auto checkAgainst (const char* name, const Pairs& pairs, int (*collation) (std::string_view, std::string_view),
+                       const Collation& reference) -> void
+    {
+        for (auto& [a, b] : pairs)
+        {
+            if (sgn (collation (a, b)) != sgn (reference (a, b)))
+            {
+                std::printf ("FAIL %s: \"%.*s\" vs \"%.*s\"\n", name, static_cast<int> (a.size()), a.data(), static_cast<int> (b.size()), b.data());
+                ++failures;
+                return;
+            }
+        }
+    }
+
+    /** Runs over all the pairs for a while, in nanoseconds per comparison. */
+    template <typename Function>
+    auto timeRun (const Pairs& pairs, Function&& collation) -> double
+    {
+        constexpr size_t comparisonsPerRun = 2'000'000;
+        static volatile int sink = 0;
+
+        int total = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0, j = 0; i < comparisonsPerRun; ++i, j = (j + 1 == pairs.size() ? 0 : j + 1))
+            total += collation (pairs[j].first, pairs[j].second);
+
+        const auto elapsed = std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now() - start).count();
+        sink = sink + total;
+        return elapsed / comparisonsPerRun;
+    }
+
+    /** The fastest of several runs of each, taking turns so that both see the same machine. */
+    template <typename Reference, typename Current>
+    auto timeBoth (const Pairs& pairs, Reference&& reference, Current&& current) -> std::pair<double, double>
+    {
+        constexpr int runs = 15;
+        std::pair<double, double> best { 1.0e30, 1.0e30 };
+
+        for (int run = 0; run < runs; ++run)
+        {
+            best.first = std::min (best.first, timeRun (pairs, reference));
+            best.second = std::min (best.second, timeRun (pairs, current));
+        }
+
+        return best;
+    }
+
+    auto report (const char* name, double reference, double current) -> void
+    {
+        if (reference > 0.0)
+            std::printf ("  %-44s %7.1f ns  %7.1f ns  %+6.1f%%\n", name, reference, current, 100.0 * (current - reference) / reference);
+        else
+            std::printf ("  %-44s %10s  %7.1f ns\n", name, "", current);
+    }
+
+    auto benchmarkRevIds() -> void
+    {
+        const auto revIds = randomRevIds (4096, 400);
+        const auto randomRevIdPairs = randomPairs (revIds, 1 << 16);
+        const auto sorted = neighbourPairs (revIds, referenceCollateRevIDs);
+
+        // One document's history: consecutive generations, the digit count changing at 10 and 100
+        std::vector<std::string> history;
+        for (int generation = 1; generation <= 400; ++generation)
+            history.push_back (std::to_string (generation) + "-" + randomHex (32));
+
+        const auto historyPairs = randomPairs (history, 1 << 16);
+
+        std::vector<std::string> sameGeneration;
+        for (int i = 0; i < 4096; ++i)
+            sameGeneration.push_back ("12-" + randomHex (32));
+
+        const auto sameGenerationPairs = randomPairs (sameGeneration, 1 << 16);
+
+        // Malformed ones have to fall back to byte order exactly like the reference does
+        std::vector<std::string> malformed { "", "-", "1-", "0-abc", "00-abc", "01-abc", "1x-abc", "123456789-abc", "abc", "12", "7-", "-7", "3-a-b" };
+        malformed.insert (malformed.end(), revIds.begin(), revIds.begin() + 32);
+
+        Pairs malformedPairs;
+        for (auto& a : malformed)
+            for (auto& b : malformed)
+                malformedPairs.emplace_back (a, b);
+
+        const auto sortedPairs = toPairs (sorted);
+
+        for (auto* pairs : { &randomRevIdPairs, &sortedPairs, &historyPairs, &sameGenerationPairs })
+            checkAgainst ("REVID", *pairs, db::collateRevIDs, referenceCollateRevIDs);
+
+        checkAgainst ("REVID", malformedPairs, db::collateRevIDs, referenceCollateRevIDs);
+
+        std::printf ("REVID                                            baseline     current\n");
+
+        const auto bench = [] (const char* name, const Pairs& pairs)
+        {
+            const auto [reference, current] = timeBoth (pairs, referenceCollateRevIDs,
+                                                        static_cast<int (*) (std::string_view, std::string_view)> (db::collateRevIDs));
+            report (name, reference, current);
+        };
+
+        bench ("random pairs, generations 1-400", randomRevIdPairs);
+        bench ("neighbours in sorted order", sortedPairs);
+        bench ("one document's history, generations 1-400", historyPairs);
+        bench ("same generation (12-<hex>)", sameGenerationPairs);
+    }
+    /** View keys as a materialised Endlesss view emits them: few bands, many riffs each, so neighbours
+        share a long prefix. */
+    auto benchmarkJsonKeys() -> void
+    {
+        std::vector<std::string> bands;
+        for (int i = 0; i < 16; ++i)
+            bands.push_back ("band_" + randomHex (32));
+
+        std::vector<std::string> keys;
+        for (int i = 0; i < 4096; ++i)
+            keys.push_back ("[\"" + bands[random() % bands.size()] + "\", \"riff:" + randomHex (24) + "\", " + std::to_string (random() % 1000) + "]");
+
+        std::vector<std::string> docIds;
+        for (int i = 0; i < 4096; ++i)
+            docIds.push_back ("\"" + randomHex (32) + "\"");
+
+        const auto collation = [] (int (*function) (std::string_view, std::string_view)) { return Collation (function); };
+
+        // The pairs point into these, so they have to stay around
+        const auto sortedDocIds = neighbourPairs (docIds, collation (db::collateJSON));
+        const auto sortedUnicode = neighbourPairs (keys, collation (db::collateJSON));
+        const auto sortedAscii = neighbourPairs (keys, collation (db::collateJSONAscii));
+        const auto sortedRaw = neighbourPairs (keys, collation (db::collateJSONRaw));
+
+        const auto docIdPairs = toPairs (sortedDocIds);
+        const auto unicodePairs = toPairs (sortedUnicode);
+        const auto asciiPairs = toPairs (sortedAscii);
+        const auto rawPairs = toPairs (sortedRaw);
+
+        std::printf ("JSON keys, neighbours in sorted order                        current\n");
+
+        const auto bench = [] (const char* name, const Pairs& pairs, int (*function) (std::string_view, std::string_view))
+        {
+            double best = 1.0e30;
+            for (int run = 0; run < 15; ++run)
+                best = std::min (best, timeRun (pairs, function));
+
+            report (name, 0.0, best);
+        };
+
+        using Function = int (*) (std::string_view, std::string_view);
+        bench ("JSON, doc ids", docIdPairs, static_cast<Function> (db::collateJSON));
+        bench ("JSON, [\"band_<hex>\", \"riff:<hex>\", n]", unicodePairs, static_cast<Function> (db::collateJSON));
+        bench ("JSON_ASCII, same keys", asciiPairs, static_cast<Function> (db::collateJSONAscii));
+        bench ("JSON_RAW, same keys", rawPairs, static_cast<Function> (db::collateJSONRaw));
+    }
+}
+
+int main()
+{
+    benchmarkRevIds();
+    benchmarkJsonKeys();
+
+    if (failures > 0)
+        std::printf ("%d comparison(s) disagree with the reference\n", failures);
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,495 @@
+#include "Attachments.h"
+#include "Sha1.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#if JUCE_MAC || JUCE_LINUX
+ #include <sys/mman.h>
+ #include <unistd.h>
+#endif
+
+#if JUCE_MAC || JUCE_LINUX
+ #include <cerrno>
+ #include <fcntl.h>
+ #include <sys/stat.h>
+#endif
+
+#if JUCE_LINUX
+ #include <sys/sendfile.h>
+#elif JUCE_MAC
+ #include <copyfile.h>
+ #include <sys/clonefile.h>
+#elif JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #ifndef WIN32_LEAN_AND_MEAN
+  #define WIN32_LEAN_AND_MEAN
+ #endif
+ #include <windows.h>
+#endif
+
+namespace db {
+
+    MappedAttachment::MappedAttachment (const juce::File& blob, Access access)
+        : map (std::make_unique<juce::MemoryMappedFile> (blob, juce::MemoryMappedFile::readOnly))
+    {
+        if (map->getData() == nullptr)
+        {
+            map.reset();
+            return;
+        }
+
+       #if JUCE_MAC || JUCE_LINUX
+        // madvise wants a page aligned address; the mapping of a whole file starts on a page anyway
+        const auto pageSize = static_cast<uintptr_t> (sysconf (_SC_PAGESIZE));
+        const auto address = reinterpret_cast<uintptr_t> (map->getData());
+        const auto start = address & ~(pageSize - 1);
+
+        madvise (reinterpret_cast<void*> (start), map->getSize() + (address - start),
+                 access == Access::sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+       #else
+        juce::ignoreUnused (access);
+       #endif
+    }
+
+    auto MappedAttachment::getData() const -> const std::byte*
+    {
+        return map != nullptr ? static_cast<const std::byte*> (map->getData()) : nullptr;
+    }
+
+    auto MappedAttachment::getSize() const -> size_t
+    {
+        return map != nullptr ? map->getSize() : 0;
+    }
+
+    auto MappedAttachment::createInputStream() const -> std::unique_ptr<juce::InputStream>
+    {
+        return std::make_unique<juce::MemoryInputStream> (getData(), getSize(), false);
+    }
+
+    static auto getHexDigitValue (char c) -> int
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    /** The digest Couchbase Lite documents use for a blob named after the hex SHA-1 of its contents. */
+    static auto getDigestForBlobName (const juce::String& name) -> std::string
+    {
+        const auto hex = name.toRawUTF8();
+        const auto length = name.getNumBytesAsUTF8();
+        Sha1Digest sha1;
+
+        if (length != sha1.size() * 2 + 5)   // 40 hex digits and ".blob"
+            return {};
+
+        for (size_t i = 0; i < sha1.size(); ++i)
+        {
+            const auto high = getHexDigitValue (hex[i * 2]);
+            const auto low = getHexDigitValue (hex[i * 2 + 1]);
+
+            if (high < 0 || low < 0)
+                return {};
+
+            sha1[i] = static_cast<uint8_t> ((high << 4) | low);
+        }
+
+        return getAttachmentDigest (sha1);
+    }
+
+    /** The name Couchbase Lite gives the blob for a digest, the SHA-1 in uppercase hex, or an empty string if
+        it isn't a SHA-1 digest. */
+    static auto getBlobNameForDigest (const juce::String& digest) -> juce::String
+    {
+        if (! digest.startsWith ("sha1-"))
+            return {};
+
+        juce::MemoryOutputStream sha1;
+        if (! juce::Base64::convertFromBase64 (sha1, digest.substring (5)) || sha1.getDataSize() != Sha1Digest().size())
+            return {};
+
+        return juce::String::toHexString (sha1.getData(), static_cast<int> (sha1.getDataSize()), 0).toUpperCase() + ".blob";
+    }
+
+    AttachmentIndex::AttachmentIndex (const juce::File& attachmentsDirectory) : directory (attachmentsDirectory)
+    {
+    }
+
+    auto AttachmentIndex::find (const juce::String& digest) -> juce::File
+    {
+        const std::string_view key (digest.toRawUTF8(), digest.getNumBytesAsUTF8());
+        const std::lock_guard scoped (lock);
+
+        if (! listed)
+            refreshIfChanged();
+
+        auto found = blobs.find (key);
+        if (found == blobs.end() && refreshIfChanged())
+            found = blobs.find (key);
+
+        if (found != blobs.end())
+            return found->second;
+
+        // Some file systems only keep the folder's modification time to the second or two (HFS+, FAT, some
+        // SMB shares), so a blob written in the same tick as the last listing doesn't show up as a change
+        const auto name = getBlobNameForDigest (digest);
+        const auto blob = name.isNotEmpty() ? directory.getChildFile (name) : juce::File();
+
+        if (! blob.existsAsFile())
+            return {};
+
+        blobs.emplace (std::string (key), blob);
+        return blob;
+    }
+
+    auto AttachmentIndex::getBlobs() -> std::vector<std::pair<std::string, juce::File>>
+    {
+        const std::lock_guard scoped (lock);
+        refreshIfChanged();
+
+        return { blobs.begin(), blobs.end() };
+    }
+
+    auto AttachmentIndex::refreshIfChanged() -> bool
+    {
+        const auto modified = directory.getLastModificationTime();
+        if (listed && modified == listedModificationTime)
+            return false;
+
+        blobs.clear();
+
+        for (auto& file : directory.findChildFiles (juce::File::findFiles, false, "*.blob"))
+        {
+            auto digest = getDigestForBlobName (file.getFileName());
+            if (! digest.empty())
+                blobs.emplace (std::move (digest), file);
+        }
+
+        listedModificationTime = modified;
+        listed = true;
+        return true;
+    }
+
+    namespace {
+
+        /** Blobs on their way from one export stage to the next. It holds at most maxBytes of them, or a
+            single bigger one. */
+        class BlobQueue
+        {
+        public:
+            struct Blob
+            {
+                size_t job = 0;
+                juce::MemoryBlock data;
+            };
+
+            BlobQueue (size_t maxBytes, int numProducers) : capacity (maxBytes), producers (numProducers)
+            {
+            }
+
+            auto push (Blob&& blob) -> void
+            {
+                std::unique_lock lock (mutex);
+                notFull.wait (lock, [&] { return bytes == 0 || bytes + blob.data.getSize() <= capacity; });
+
+                bytes += blob.data.getSize();
+                blobs.push_back (std::move (blob));
+                notEmpty.notify_one();
+            }
+
+            /** Returns false once every producer has finished and the queue is drained. */
+            auto pop (Blob& blob) -> bool
+            {
+                std::unique_lock lock (mutex);
+                notEmpty.wait (lock, [this] { return ! blobs.empty() || producers == 0; });
+
+                if (blobs.empty())
+                    return false;
+
+                blob = std::move (blobs.front());
+                blobs.pop_front();
+                bytes -= blob.data.getSize();
+                notFull.notify_all();   // several small blobs may fit now
+                return true;
+            }
+
+            void producerFinished()
+            {
+                std::lock_guard lock (mutex);
+                --producers;
+                notEmpty.notify_all();
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable notFull, notEmpty;
+            std::deque<Blob> blobs;
+            const size_t capacity;
+            size_t bytes = 0;
+            int producers;
+        };
+
+        /** What the threads of one export stage got through, and how long they were busy doing it. */
+        struct StageCounter
+        {
+            template <typename Work>
+            auto time (Work&& work) -> void
+            {
+                const auto start = juce::Time::getHighResolutionTicks();
+                work();
+                busyTicks += juce::Time::getHighResolutionTicks() - start;
+            }
+
+            auto add (juce::int64 size) -> void
+            {
+                ++files;
+                bytes += size;
+            }
+
+            auto getStage (int threads) const -> ExportStats::Stage
+            {
+                return { threads, files, bytes, juce::Time::highResolutionTicksToSeconds (busyTicks) };
+            }
+
+            std::atomic<juce::int64> files { 0 }, bytes { 0 }, busyTicks { 0 };
+        };
+
+        /** How copyBlob got a file across; inKernel means its data never passed through this process. */
+        enum class BlobCopy { failed, copied, inKernel };
+
+        /** Copies a file into a new one that doesn't exist yet, in the kernel where it can: copy_file_range
+            or sendfile on Linux, CopyFileEx on Windows and a clone on Mac volumes that support one (APFS). */
+        auto copyToNewFile (const juce::File& source, const juce::File& destination) -> BlobCopy
+        {
+           #if JUCE_LINUX
+            const auto in = open (source.getFullPathName().toRawUTF8(), O_RDONLY | O_CLOEXEC);
+            if (in < 0)
+                return BlobCopy::failed;
+
+            struct stat info;
+            const auto out = fstat (in, &info) == 0 ? open (destination.getFullPathName().toRawUTF8(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644) : -1;
+            auto remaining = out >= 0 ? static_cast<juce::int64> (info.st_size) : -1;
+            bool useSendfile = false;
+
+            while (remaining > 0)
+            {
+                const auto chunk = static_cast<size_t> (juce::jmin (remaining, static_cast<juce::int64> (1) << 30));
+                const auto copied = useSendfile ? sendfile (out, in, nullptr, chunk)
+                                                : copy_file_range (in, nullptr, out, nullptr, chunk, 0);
+                if (copied > 0)
+                    remaining -= copied;
+                else if (copied < 0 && errno == EINTR)
+                    continue;
+                else if (copied < 0 && ! useSendfile && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+                    useSendfile = true;     // e.g. across file systems on older kernels; both carry on from the file offsets
+                else
+                    break;                  // an error, or the source got shorter
+            }
+
+            close (in);
+            if (out >= 0 && close (out) != 0)
+                remaining = -1;
+
+            return remaining == 0 ? BlobCopy::inKernel : BlobCopy::failed;
+           #elif JUCE_MAC
+            // A clone shares the source's blocks, so nothing is copied at all. It doesn't work across volumes
+            // or off APFS; those get their data copied by fcopyfile, through a buffer in this process.
+            if (clonefile (source.getFullPathName().toRawUTF8(), destination.getFullPathName().toRawUTF8(), 0) == 0)
+                return BlobCopy::inKernel;
+
+            const auto in = open (source.getFullPathName().toRawUTF8(), O_RDONLY | O_CLOEXEC);
+            if (in < 0)
+                return BlobCopy::failed;
+
+            const auto out = open (destination.getFullPathName().toRawUTF8(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            auto copied = out >= 0 && fcopyfile (in, out, nullptr, COPYFILE_DATA) == 0;
+
+            close (in);
+            if (out >= 0 && close (out) != 0)
+                copied = false;
+
+            return copied ? BlobCopy::copied : BlobCopy::failed;
+           #elif JUCE_WINDOWS
+            // The system's copy engine moves the data without it passing through this process, and on recent
+            // versions of Windows clones the blocks on ReFS and Dev Drive volumes
+            return CopyFileExW (source.getFullPathName().toWideCharPointer(), destination.getFullPathName().toWideCharPointer(),
+                                nullptr, nullptr, nullptr, COPY_FILE_FAIL_IF_EXISTS) ? BlobCopy::inKernel : BlobCopy::failed;
+           #else
+            return source.copyFileTo (destination) ? BlobCopy::copied : BlobCopy::failed;
+           #endif
+        }
+
+        /** Copies a blob into a temporary file next to the destination, which only replaces the destination
+            once it is complete. A copy that fails leaves whatever was there before untouched. */
+        auto copyBlob (const juce::File& source, const juce::File& destination) -> BlobCopy
+        {
+            juce::TemporaryFile temporary (destination);
+            const auto copied = copyToNewFile (source, temporary.getFile());
+
+            return copied != BlobCopy::failed && temporary.overwriteTargetFileWithTemporary() ? copied : BlobCopy::failed;
+        }
+
+        auto writeBlob (const juce::File& destination, const juce::MemoryBlock& data) -> bool
+        {
+            // Unlike replaceWithData this also writes empty files
+            juce::TemporaryFile temporary (destination);
+            {
+                juce::FileOutputStream out (temporary.getFile());
+                if (! out.openedOk() || ! out.write (data.getData(), data.getSize()))
+                    return false;
+            }
+
+            return temporary.overwriteTargetFileWithTemporary();
+        }
+    }
+
+    auto exportAttachments (const std::vector<ExportJob>& jobs, const ExportOptions& options) -> ExportStats
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        const auto getThreads = [] (int requested) { return requested > 0 ? requested : juce::jmax (1, juce::SystemStats::getNumCpus()); };
+        const auto transforming = static_cast<bool> (options.transform);
+
+        ExportStats stats;
+        stats.read.threads = transforming ? getThreads (options.readThreads) : 0;
+        stats.transform.threads = transforming ? getThreads (options.transformThreads) : 0;
+        stats.write.threads = getThreads (options.writeThreads);
+
+        StageCounter reads, transforms, writes;
+        std::atomic<juce::int64> kernelCopies { 0 };
+        BlobQueue toTransform (options.maxBytesInFlight / 2, stats.read.threads);
+        BlobQueue toWrite (options.maxBytesInFlight / 2, stats.transform.threads);
+        std::atomic<size_t> nextJob { 0 };
+        std::mutex failedLock;
+
+        const auto fail = [&] (size_t job)
+        {
+            const std::lock_guard scoped (failedLock);
+            stats.failed.push_back (jobs[job].source);
+        };
+
+        const auto createFolder = [] (const juce::File& destination) { return destination.getParentDirectory().createDirectory().wasOk(); };
+
+        const auto copyJobs = [&]
+        {
+            for (auto job = nextJob++; job < jobs.size(); job = nextJob++)
+            {
+                writes.time ([&]
+                {
+                    const auto& [source, destination] = jobs[job];
+                    const auto size = source.getSize();
+
+                    const auto copied = createFolder (destination) ? copyBlob (source, destination) : BlobCopy::failed;
+
+                    if (copied == BlobCopy::failed)
+                    {
+                        fail (job);
+                        return;
+                    }
+
+                    writes.add (size);
+
+                    if (copied == BlobCopy::inKernel)
+                        ++kernelCopies;
+                });
+            }
+        };
+
+        const auto readJobs = [&]
+        {
+            for (auto job = nextJob++; job < jobs.size(); job = nextJob++)
+            {
+                BlobQueue::Blob blob { job, {} };
+                bool read = false;
+                reads.time ([&] { read = jobs[job].source.loadFileAsData (blob.data); });
+
+                if (! read)
+                {
+                    fail (job);
+                    continue;
+                }
+
+                reads.add (static_cast<juce::int64> (blob.data.getSize()));
+                toTransform.push (std::move (blob));
+            }
+
+            toTransform.producerFinished();
+        };
+
+        const auto transformBlobs = [&]
+        {
+            BlobQueue::Blob blob;
+            while (toTransform.pop (blob))
+            {
+                BlobQueue::Blob output { blob.job, {} };
+                bool transformed = false;
+                transforms.time ([&] { transformed = options.transform ({ static_cast<const std::byte*> (blob.data.getData()), blob.data.getSize() }, output.data); });
+
+                if (! transformed)
+                {
+                    fail (blob.job);
+                    continue;
+                }
+
+                transforms.add (static_cast<juce::int64> (blob.data.getSize()));
+                blob = {};
+                toWrite.push (std::move (output));
+            }
+
+            toWrite.producerFinished();
+        };
+
+        const auto writeBlobs = [&]
+        {
+            BlobQueue::Blob blob;
+            while (toWrite.pop (blob))
+            {
+                writes.time ([&]
+                {
+                    const auto& destination = jobs[blob.job].destination;
+
+                    if (createFolder (destination) && writeBlob (destination, blob.data))
+                        writes.add (static_cast<juce::int64> (blob.data.getSize()));
+                    else
+                        fail (blob.job);
+                });
+            }
+        };
+
+        std::vector<std::thread> threads;
+
+        if (transforming)
+        {
+            for (int i = 0; i < stats.read.threads; ++i)
+                threads.emplace_back (readJobs);
+
+            for (int i = 0; i < stats.transform.threads; ++i)
+                threads.emplace_back (transformBlobs);
+
+            for (int i = 0; i < stats.write.threads; ++i)
+                threads.emplace_back (writeBlobs);
+        }
+        else
+        {
+            for (int i = 0; i < stats.write.threads; ++i)
+                threads.emplace_back (copyJobs);
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        stats.read = reads.getStage (stats.read.threads);
+        stats.transform = transforms.getStage (stats.transform.threads);
+        stats.write = writes.getStage (stats.write.threads);
+        stats.zeroCopy = stats.write.files > 0 && kernelCopies == stats.write.files;
+
+        std::sort (stats.failed.begin(), stats.failed.end());
+        stats.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return stats;
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <JuceHeader.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace db {
+
+    /** An attachment's .blob mapped read-only into memory, so decoders and hashes can run straight over
+        the file's pages instead of a copy read into a MemoryBlock.
+
+        Pages are only read in as they are touched. With sequential access the OS is told so (madvise on
+        Mac and Linux) and reads ahead more aggressively, dropping pages behind the reader sooner.
+        The mapping stays valid for as long as this object lives.
+    */
+    class MappedAttachment
+    {
+    public:
+        enum class Access
+        {
+            sequential,
+            random
+        };
+
+        MappedAttachment() = default;
+        explicit MappedAttachment (const juce::File& blob, Access access = Access::sequential);
+
+        /** False if the file couldn't be mapped, e.g. because it doesn't exist or is empty. */
+        auto isValid() const -> bool { return getData() != nullptr; }
+
+        auto getData() const -> const std::byte*;
+        auto getSize() const -> size_t;
+        auto getBytes() const -> std::span<const std::byte> { return { getData(), getSize() }; }
+
+        /** A stream reading the mapped bytes in place; it must not outlive this object. */
+        auto createInputStream() const -> std::unique_ptr<juce::InputStream>;
+
+    private:
+        std::unique_ptr<juce::MemoryMappedFile> map;
+    };
+
+    /** Finds attachment files by the digest documents refer to them with ("sha1-<base64>"), without
+        decoding and re-encoding the digest or touching the disk for every lookup.
+
+        The attachments folder is listed on the first lookup, turning each "<hex sha1>.blob" name into
+        the digest it stands for. When a digest isn't there the folder's modification time is checked,
+        and it is listed again if files have come or gone since. Lookups can come from any thread.
+    */
+    class AttachmentIndex
+    {
+    public:
+        explicit AttachmentIndex (const juce::File& attachmentsDirectory);
+
+        /** The blob for a digest, or File() if there is none. */
+        auto find (const juce::String& digest) -> juce::File;
+
+        /** Every blob in the folder with its digest, listing the folder again first if it has changed. */
+        auto getBlobs() -> std::vector<std::pair<std::string, juce::File>>;
+
+        auto getDirectory() const -> const juce::File& { return directory; }
+
+    private:
+        struct Hash
+        {
+            using is_transparent = void;
+            auto operator() (std::string_view text) const -> size_t { return std::hash<std::string_view>() (text); }
+        };
+
+        /** Lists the folder again if its modification time changed; returns true if it did. */
+        auto refreshIfChanged() -> bool;
+
+        const juce::File directory;
+        std::mutex lock;
+        juce::Time listedModificationTime;
+        bool listed = false;
+        std::unordered_map<std::string, juce::File, Hash, std::equal_to<>> blobs;
+    };
+
+    /** What verifyAttachments found. */
+    struct AttachmentReport
+    {
+        std::vector<std::string> missing;   // digests a stored revision body refers to that have no blob
+        std::vector<juce::File> corrupt;    // blobs whose contents don't hash to their digest
+        std::vector<juce::File> orphaned;   // blobs no stored revision body refers to
+
+        int referenced = 0;                 // distinct digests the stored revision bodies refer to
+        int verified = 0;                   // blobs hashed and found intact
+        juce::int64 bytesHashed = 0;
+        int threads = 1;
+        double seconds = 0.0;
+
+        auto isIntact() const -> bool { return missing.empty() && corrupt.empty(); }
+        auto getMegabytesPerSecond() const -> double { return seconds > 0.0 ? static_cast<double> (bytesHashed) / (1024.0 * 1024.0) / seconds : 0.0; }
+    };
+
+    /** What compactAttachments or linkDuplicateAttachments did. */
+    struct AttachmentCompaction
+    {
+        std::vector<juce::File> removed;    // orphaned blobs deleted, or moved into the archive folder
+        int linked = 0;                     // duplicate blobs replaced with a hard link to another copy
+        juce::int64 bytesReclaimed = 0;     // disk space given back, not counting archived blobs
+        juce::int64 bytesArchived = 0;
+        double seconds = 0.0;
+    };
+
+    /** One blob to export, e.g. a getAttachment result, and where it goes. */
+    struct ExportJob
+    {
+        juce::File source;
+        juce::File destination;
+    };
+
+    struct ExportOptions
+    {
+        /** Turns a blob into what gets written, e.g. to transcode or compress it; returning false fails
+            that file. It is called from several threads at once. Left empty, blobs are copied as they are,
+            which lets the kernel copy them without passing them through this process. */
+        std::function<bool (std::span<const std::byte> blob, juce::MemoryBlock& output)> transform;
+
+        /** Threads per stage, 0 for one per CPU. Without a transform only the writers run. */
+        int readThreads = 2;
+        int transformThreads = 0;
+        int writeThreads = 2;
+
+        /** The most blob data held in memory between the stages; a bigger blob still goes through alone. */
+        size_t maxBytesInFlight = 64 * 1024 * 1024;
+    };
+
+    /** What exportAttachments did, stage by stage. */
+    struct ExportStats
+    {
+        struct Stage
+        {
+            int threads = 0;
+            juce::int64 files = 0;
+            juce::int64 bytes = 0;
+            double busySeconds = 0.0;   // summed over the stage's threads, not counting waits on the queues
+
+            /** What the stage would get through if it never had to wait for the others. */
+            auto getMegabytesPerSecond() const -> double { return busySeconds > 0.0 ? static_cast<double> (bytes) / (1024.0 * 1024.0) * threads / busySeconds : 0.0; }
+        };
+
+        Stage read, transform, write;
+        std::vector<juce::File> failed;     // sources that couldn't be exported
+        bool zeroCopy = false;              // every file was copied in the kernel; false if any fell back to a buffered copy
+        double seconds = 0.0;
+    };
+
+    /** Exports blobs through a pipeline of reader, transform and writer threads, with bounded queues in
+        between so memory use stays flat however many files there are. Destination folders are created
+        as needed and existing files are replaced. */
+    auto exportAttachments (const std::vector<ExportJob>& jobs, const ExportOptions& options = {}) -> ExportStats;
+}
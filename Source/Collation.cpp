@@ -0,0 +1,902 @@
+#include "Collation.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined (__x86_64__) || defined (_M_X64)
+ #define DB_COLLATION_X64 1
+ #include <immintrin.h>
+ #if defined (_MSC_VER)
+  #include <intrin.h>
+  #define DB_TARGET_AVX2
+ #else
+  #define DB_TARGET_AVX2 __attribute__ ((target ("avx2")))
+ #endif
+#endif
+
+namespace db {
+
+    namespace {
+
+        /** JSON token types in the order they collate. The closing brackets come first so that an array
+            or object sorts before a longer one that starts with the same values. */
+        enum class Token
+        {
+            endArray,
+            endObject,
+            comma,
+            colon,
+            null,
+            falseValue,
+            trueValue,
+            number,
+            string,
+            array,
+            object,
+            illegal
+        };
+
+        enum class Mode
+        {
+            unicode,
+            ascii,
+            raw
+        };
+
+        /** Where a token type sorts. JSON_RAW orders the value types the way Couchbase Lite's raw mode does:
+            numbers < false < null < true < objects < arrays < strings. */
+        template <Mode mode>
+        constexpr auto rank (Token type) -> int
+        {
+            if constexpr (mode == Mode::raw)
+            {
+                constexpr int rawRanks[] = { -4, -3, -2, -1, 2, 1, 3, 0, 6, 5, 4, 7 };
+                return rawRanks[static_cast<int> (type)];
+            }
+            else
+            {
+                return static_cast<int> (type);
+            }
+        }
+
+        /** Returned by compareValues when either side isn't valid JSON. */
+        constexpr int malformed = INT_MIN;
+
+        struct Cursor
+        {
+            const char* p;
+            const char* end;
+        };
+
+        auto sign (int64_t n) -> int
+        {
+            return n > 0 ? 1 : (n < 0 ? -1 : 0);
+        }
+
+        auto isDigit (char c) -> bool
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        auto advance (Cursor& in, size_t count) -> void
+        {
+            in.p += std::min (count, static_cast<size_t> (in.end - in.p));
+        }
+
+        auto peekToken (Cursor& in) -> Token
+        {
+            while (in.p < in.end && (*in.p == ' ' || *in.p == '\t' || *in.p == '\n' || *in.p == '\r'))
+                ++in.p;
+
+            if (in.p == in.end)
+                return Token::illegal;
+
+            switch (*in.p)
+            {
+                case 'n': return Token::null;
+                case 'f': return Token::falseValue;
+                case 't': return Token::trueValue;
+                case '-':
+                case '0': case '1': case '2': case '3': case '4':
+                case '5': case '6': case '7': case '8': case '9':
+                          return Token::number;
+                case '"': return Token::string;
+                case '[': return Token::array;
+                case '{': return Token::object;
+                case ']': return Token::endArray;
+                case '}': return Token::endObject;
+                case ',': return Token::comma;
+                case ':': return Token::colon;
+                default:  return Token::illegal;
+            }
+        }
+
+        //==============================================================================
+        /** A JSON number read as 0.d1d2d3... x 10^exponent, straight from the text. Comparing two of
+            these is exact and needs neither a float parser nor a copy of the digits. */
+        struct Decimal
+        {
+            bool negative = false;
+            bool zero = true;
+            int64_t exponent = 0;
+            const char* digits = nullptr;     // first significant digit; the run may still contain the '.'
+            const char* digitsEnd = nullptr;
+        };
+
+        auto readNumber (Cursor& in) -> Decimal
+        {
+            Decimal number;
+            const char* p = in.p;
+
+            if (p < in.end && *p == '-')
+            {
+                number.negative = true;
+                ++p;
+            }
+
+            const char* mantissa = p;
+            int64_t integerDigits = 0;
+
+            for (; p < in.end && isDigit (*p); ++p)
+                ++integerDigits;
+
+            if (p < in.end && *p == '.')
+                for (++p; p < in.end && isDigit (*p); ++p) {}
+
+            const char* mantissaEnd = p;
+            int64_t exponent = 0;
+
+            if (p < in.end && (*p == 'e' || *p == 'E'))
+            {
+                bool negativeExponent = false;
+                if (++p < in.end && (*p == '+' || *p == '-'))
+                    negativeExponent = *p++ == '-';
+
+                for (; p < in.end && isDigit (*p); ++p)
+                    if (exponent < 100000000) // far outside any double already
+                        exponent = 10 * exponent + (*p - '0');
+
+                if (negativeExponent)
+                    exponent = -exponent;
+            }
+
+            in.p = p;
+
+            int64_t leadingZeros = 0;
+            const char* first = mantissa;
+
+            for (; first < mantissaEnd && (*first == '0' || *first == '.'); ++first)
+                if (*first == '0')
+                    ++leadingZeros;
+
+            if (first == mantissaEnd)
+                return number;
+
+            number.zero = false;
+            number.digits = first;
+            number.digitsEnd = mantissaEnd;
+            number.exponent = integerDigits - leadingZeros + exponent;
+            return number;
+        }
+
+        auto hasNonZeroDigit (const char* p, const char* end) -> bool
+        {
+            for (; p < end; ++p)
+                if (*p >= '1' && *p <= '9')
+                    return true;
+            return false;
+        }
+
+        auto compareMagnitudes (const Decimal& a, const Decimal& b) -> int
+        {
+            if (a.exponent != b.exponent)
+                return a.exponent < b.exponent ? -1 : 1;
+
+            const char* p = a.digits;
+            const char* q = b.digits;
+
+            for (;;)
+            {
+                if (p < a.digitsEnd && *p == '.')
+                    ++p;
+                if (q < b.digitsEnd && *q == '.')
+                    ++q;
+                if (p == a.digitsEnd || q == b.digitsEnd)
+                    break;
+                if (*p != *q)
+                    return *p < *q ? -1 : 1;
+                ++p;
+                ++q;
+            }
+
+            // Whatever is left over only matters if it isn't trailing zeros
+            if (hasNonZeroDigit (p, a.digitsEnd))
+                return 1;
+            if (hasNonZeroDigit (q, b.digitsEnd))
+                return -1;
+            return 0;
+        }
+
+        auto compareNumbers (const Decimal& a, const Decimal& b) -> int
+        {
+            const int sign1 = a.zero ? 0 : (a.negative ? -1 : 1);
+            const int sign2 = b.zero ? 0 : (b.negative ? -1 : 1);
+
+            if (sign1 != sign2)
+                return sign1 < sign2 ? -1 : 1;
+            if (sign1 == 0)
+                return 0;
+
+            const int magnitude = compareMagnitudes (a, b);
+            return sign1 < 0 ? -magnitude : magnitude;
+        }
+
+        //==============================================================================
+        auto hexValue (char c) -> int
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return 0;
+        }
+
+        auto readHex4 (Cursor& in) -> int32_t
+        {
+            if (in.end - in.p < 4)
+            {
+                in.p = in.end;
+                return 0xfffd;
+            }
+
+            int32_t value = 0;
+            for (int i = 0; i < 4; ++i)
+                value = (value << 4) | hexValue (*in.p++);
+            return value;
+        }
+
+        auto readEscape (Cursor& in) -> int32_t
+        {
+            if (in.p >= in.end)
+                return -1;
+
+            switch (*in.p++)
+            {
+                case 'b': return '\b';
+                case 'f': return '\f';
+                case 'n': return '\n';
+                case 'r': return '\r';
+                case 't': return '\t';
+                case 'u':
+                {
+                    const auto codePoint = readHex4 (in);
+
+                    if (codePoint >= 0xd800 && codePoint < 0xdc00 && in.end - in.p >= 6 && in.p[0] == '\\' && in.p[1] == 'u')
+                    {
+                        Cursor lookahead { in.p + 2, in.end };
+                        const auto low = readHex4 (lookahead);
+                        if (low >= 0xdc00 && low < 0xe000)
+                        {
+                            in.p = lookahead.p;
+                            return 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                    }
+
+                    return codePoint;
+                }
+                default:  // \" \\ \/, and anything unknown stands for itself
+                    return static_cast<unsigned char> (in.p[-1]);
+            }
+        }
+
+        auto readUtf8 (unsigned char lead, Cursor& in) -> int32_t
+        {
+            int continuationBytes;
+            int32_t codePoint;
+
+            if ((lead & 0xe0) == 0xc0)      { continuationBytes = 1; codePoint = lead & 0x1f; }
+            else if ((lead & 0xf0) == 0xe0) { continuationBytes = 2; codePoint = lead & 0x0f; }
+            else if ((lead & 0xf8) == 0xf0) { continuationBytes = 3; codePoint = lead & 0x07; }
+            else                            return lead; // stray continuation byte, compare it as it is
+
+            for (; continuationBytes > 0 && in.p < in.end && (static_cast<unsigned char> (*in.p) & 0xc0) == 0x80; --continuationBytes)
+                codePoint = (codePoint << 6) | (static_cast<unsigned char> (*in.p++) & 0x3f);
+
+            return codePoint;
+        }
+
+        /** Next code point of a string body with escapes and UTF-8 decoded,
+            or -1 once the closing quote (which is consumed) or the end of the input is reached. */
+        auto nextCodePoint (Cursor& in) -> int32_t
+        {
+            if (in.p >= in.end)
+                return -1;
+
+            const auto c = static_cast<unsigned char> (*in.p++);
+
+            if (c == '"')  return -1;
+            if (c == '\\') return readEscape (in);
+            if (c < 0x80)  return c;
+            return readUtf8 (c, in);
+        }
+
+        //==============================================================================
+        /** Simple one-to-one case folding for Latin, Greek and Cyrillic. */
+        auto foldCase (int32_t c) -> int32_t
+        {
+            if (c >= 'A' && c <= 'Z')                      return c + 32;
+            if (c < 0xc0)                                  return c;
+            if (c <= 0xde)                                 return c == 0xd7 ? c : c + 32;
+            if (c >= 0x100 && c <= 0x137)                  return c | 1;
+            if (c >= 0x139 && c <= 0x148)                  return (c & 1) ? c + 1 : c;
+            if (c >= 0x14a && c <= 0x177)                  return c | 1;
+            if (c >= 0x179 && c <= 0x17e)                  return (c & 1) ? c + 1 : c;
+            if (c >= 0x391 && c <= 0x3ab && c != 0x3a2)    return c + 32;
+            if (c >= 0x410 && c <= 0x42f)                  return c + 32;
+            if (c >= 0x400 && c <= 0x40f)                  return c + 80;
+            return c;
+        }
+
+        /** Primary weights for ASCII, following the root collation order: whitespace, punctuation and
+            symbols, digits, then letters. Upper and lowercase letters share a weight. */
+        constexpr auto makeAsciiWeights() -> std::array<uint8_t, 128>
+        {
+            constexpr std::string_view order = "\t\n\v\f\r _-,;:!?.'\"()[]{}@*/\\&#%`^+<=>|~$0123456789abcdefghijklmnopqrstuvwxyz";
+
+            std::array<uint8_t, 128> weights {};
+            for (auto& weight : weights)
+                weight = 1; // remaining control characters
+
+            for (size_t i = 0; i < order.size(); ++i)
+                weights[static_cast<size_t> (order[i])] = static_cast<uint8_t> (i + 2);
+
+            for (int c = 'A'; c <= 'Z'; ++c)
+                weights[static_cast<size_t> (c)] = weights[static_cast<size_t> (c + 32)];
+
+            return weights;
+        }
+
+        constexpr auto asciiWeights = makeAsciiWeights();
+
+        /** A Latin-1 or Latin Extended-A letter as the root collation sees it: the base letter(s) it sorts
+            with and a secondary weight for its accent, which only decides between strings whose letters
+            are otherwise the same. Ligatures and ß expand to two letters. An empty base means the letter
+            has a primary weight of its own. */
+        struct LatinLetter
+        {
+            char base[3];
+            uint8_t accent;     // acute, grave, breve, circumflex, caron, ring, diaeresis, double acute,
+                                // tilde, dot above, stroke, cedilla, ogonek, macron, middle dot, ligature, long s
+        };
+
+        constexpr LatinLetter latinLetters[] =
+        {
+            { "a",   2 }, { "a",   1 }, { "a",   4 }, { "a",   9 }, { "a",   7 }, { "a",   6 }, { "ae", 16 }, { "c",  12 },   // U+00C0
+            { "e",   2 }, { "e",   1 }, { "e",   4 }, { "e",   7 }, { "i",   2 }, { "i",   1 }, { "i",   4 }, { "i",   7 },   // U+00C8
+            { "",    0 }, { "n",   9 }, { "o",   2 }, { "o",   1 }, { "o",   4 }, { "o",   9 }, { "o",   7 }, { "",    0 },   // U+00D0
+            { "o",  11 }, { "u",   2 }, { "u",   1 }, { "u",   4 }, { "u",   7 }, { "y",   1 }, { "",    0 }, { "ss", 16 },   // U+00D8
+            { "a",   2 }, { "a",   1 }, { "a",   4 }, { "a",   9 }, { "a",   7 }, { "a",   6 }, { "ae", 16 }, { "c",  12 },   // U+00E0
+            { "e",   2 }, { "e",   1 }, { "e",   4 }, { "e",   7 }, { "i",   2 }, { "i",   1 }, { "i",   4 }, { "i",   7 },   // U+00E8
+            { "",    0 }, { "n",   9 }, { "o",   2 }, { "o",   1 }, { "o",   4 }, { "o",   9 }, { "o",   7 }, { "",    0 },   // U+00F0
+            { "o",  11 }, { "u",   2 }, { "u",   1 }, { "u",   4 }, { "u",   7 }, { "y",   1 }, { "",    0 }, { "y",   7 },   // U+00F8
+            { "a",  14 }, { "a",  14 }, { "a",   3 }, { "a",   3 }, { "a",  13 }, { "a",  13 }, { "c",   1 }, { "c",   1 },   // U+0100
+            { "c",   4 }, { "c",   4 }, { "c",  10 }, { "c",  10 }, { "c",   5 }, { "c",   5 }, { "d",   5 }, { "d",   5 },   // U+0108
+            { "d",  11 }, { "d",  11 }, { "e",  14 }, { "e",  14 }, { "e",   3 }, { "e",   3 }, { "e",  10 }, { "e",  10 },   // U+0110
+            { "e",  13 }, { "e",  13 }, { "e",   5 }, { "e",   5 }, { "g",   4 }, { "g",   4 }, { "g",   3 }, { "g",   3 },   // U+0118
+            { "g",  10 }, { "g",  10 }, { "g",  12 }, { "g",  12 }, { "h",   4 }, { "h",   4 }, { "h",  11 }, { "h",  11 },   // U+0120
+            { "i",   9 }, { "i",   9 }, { "i",  14 }, { "i",  14 }, { "i",   3 }, { "i",   3 }, { "i",  13 }, { "i",  13 },   // U+0128
+            { "i",  10 }, { "",    0 }, { "ij", 16 }, { "ij", 16 }, { "j",   4 }, { "j",   4 }, { "k",  12 }, { "k",  12 },   // U+0130
+            { "",    0 }, { "l",   1 }, { "l",   1 }, { "l",  12 }, { "l",  12 }, { "l",   5 }, { "l",   5 }, { "l",  15 },   // U+0138
+            { "l",  15 }, { "l",  11 }, { "l",  11 }, { "n",   1 }, { "n",   1 }, { "n",  12 }, { "n",  12 }, { "n",   5 },   // U+0140
+            { "n",   5 }, { "",    0 }, { "",    0 }, { "",    0 }, { "o",  14 }, { "o",  14 }, { "o",   3 }, { "o",   3 },   // U+0148
+            { "o",   8 }, { "o",   8 }, { "oe", 16 }, { "oe", 16 }, { "r",   1 }, { "r",   1 }, { "r",  12 }, { "r",  12 },   // U+0150
+            { "r",   5 }, { "r",   5 }, { "s",   1 }, { "s",   1 }, { "s",   4 }, { "s",   4 }, { "s",  12 }, { "s",  12 },   // U+0158
+            { "s",   5 }, { "s",   5 }, { "t",  12 }, { "t",  12 }, { "t",   5 }, { "t",   5 }, { "t",  11 }, { "t",  11 },   // U+0160
+            { "u",   9 }, { "u",   9 }, { "u",  14 }, { "u",  14 }, { "u",   3 }, { "u",   3 }, { "u",   6 }, { "u",   6 },   // U+0168
+            { "u",   8 }, { "u",   8 }, { "u",  13 }, { "u",  13 }, { "w",   4 }, { "w",   4 }, { "y",   4 }, { "y",   4 },   // U+0170
+            { "y",   7 }, { "z",   1 }, { "z",   1 }, { "z",  10 }, { "z",  10 }, { "z",   5 }, { "z",   5 }, { "s",  17 },   // U+0178
+        };
+
+        auto getLatinLetter (int32_t c) -> const LatinLetter*
+        {
+            if (c < 0xc0 || c > 0x17f)
+                return nullptr;
+
+            const auto& letter = latinLetters[c - 0xc0];
+            return letter.base[0] != 0 ? &letter : nullptr;
+        }
+
+        /** One step through a string in collation order. primary is -1 at the end of the string. */
+        struct CollationElement
+        {
+            int32_t primary;
+            int32_t secondary;
+            int32_t codePoint;
+        };
+
+        /** Reads a string body as collation elements: accented Latin letters weigh the same as their base
+            letter, and everything else outside ASCII sorts after it by code point. */
+        class CollationElementReader
+        {
+        public:
+            explicit CollationElementReader (Cursor& s) : in (s) {}
+
+            auto next() -> CollationElement
+            {
+                if (pending != 0)
+                {
+                    const auto second = std::exchange (pending, 0);
+                    return { asciiWeights[static_cast<size_t> (second)], pendingAccent, pendingCodePoint };
+                }
+
+                const auto c = nextCodePoint (in);
+
+                if (c < 0)
+                    return { -1, 0, -1 };
+
+                if (c < 128)
+                    return { asciiWeights[static_cast<size_t> (c)], 0, c };
+
+                if (const auto* letter = getLatinLetter (c))
+                {
+                    if (letter->base[1] != 0)
+                    {
+                        pending = letter->base[1];
+                        pendingAccent = letter->accent;
+                        pendingCodePoint = c;
+                    }
+
+                    return { asciiWeights[static_cast<size_t> (letter->base[0])], letter->accent, c };
+                }
+
+                return { 0x100 + foldCase (c), 0, c };
+            }
+
+        private:
+            Cursor& in;
+            char pending = 0;       // the second letter of an expansion
+            int32_t pendingAccent = 0, pendingCodePoint = 0;
+        };
+
+        /** Tie-break for code points with the same primary weight: lowercase first, then code point order. */
+        auto compareTertiary (int32_t c1, int32_t c2) -> int
+        {
+            const bool upper1 = foldCase (c1) != c1;
+            const bool upper2 = foldCase (c2) != c2;
+
+            if (upper1 != upper2)
+                return upper1 ? 1 : -1;
+            return c1 < c2 ? -1 : 1;
+        }
+
+        //==============================================================================
+        /** True where the search for the first difference should stop: the bytes differ or the first one
+            is a quote or backslash, so that everything skipped is known to be plain string content on both
+            sides. */
+        auto isStop (char c1, char c2) -> bool
+        {
+            return c1 != c2 || c1 == '"' || c1 == '\\';
+        }
+
+        /** Portable fallback: eight bytes at a time on little-endian CPUs. The zero-byte test can flag bytes
+            above a real match, but never below one, so the lowest flagged byte is always right. */
+        auto findMismatchScalar (const char* p, const char* q, size_t length) -> size_t
+        {
+            size_t i = 0;
+
+            if constexpr (std::endian::native == std::endian::little)
+            {
+                constexpr uint64_t ones = 0x0101010101010101ull;
+                constexpr uint64_t highBits = 0x8080808080808080ull;
+                const auto hasZeroByte = [] (uint64_t v) { return (v - ones) & ~v & highBits; };
+
+                for (; i + 8 <= length; i += 8)
+                {
+                    uint64_t x, y;
+                    std::memcpy (&x, p + i, 8);
+                    std::memcpy (&y, q + i, 8);
+
+                    const auto stops = (x ^ y) | hasZeroByte (x ^ (ones * '"')) | hasZeroByte (x ^ (ones * '\\'));
+
+                    if (stops != 0)
+                        return i + static_cast<size_t> (std::countr_zero (stops)) / 8;
+                }
+            }
+
+            for (; i < length; ++i)
+                if (isStop (p[i], q[i]))
+                    return i;
+
+            return length;
+        }
+
+       #if DB_COLLATION_X64
+        auto findMismatchSSE2 (const char* p, const char* q, size_t length) -> size_t
+        {
+            size_t i = 0;
+
+            for (; i + 16 <= length; i += 16)
+            {
+                const auto x = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (p + i));
+                const auto y = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (q + i));
+                const auto same = _mm_andnot_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (x, _mm_set1_epi8 ('"')),
+                                                                  _mm_cmpeq_epi8 (x, _mm_set1_epi8 ('\\'))),
+                                                    _mm_cmpeq_epi8 (x, y));
+
+                if (const auto stops = static_cast<uint32_t> (_mm_movemask_epi8 (same)) ^ 0xffffu)
+                    return i + static_cast<size_t> (std::countr_zero (stops));
+            }
+
+            return i + findMismatchScalar (p + i, q + i, length - i);
+        }
+
+        DB_TARGET_AVX2 auto findMismatchAVX2 (const char* p, const char* q, size_t length) -> size_t
+        {
+            size_t i = 0;
+
+            for (; i + 32 <= length; i += 32)
+            {
+                const auto x = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (p + i));
+                const auto y = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (q + i));
+                const auto same = _mm256_andnot_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (x, _mm256_set1_epi8 ('"')),
+                                                                        _mm256_cmpeq_epi8 (x, _mm256_set1_epi8 ('\\'))),
+                                                       _mm256_cmpeq_epi8 (x, y));
+
+                if (const auto stops = ~static_cast<uint32_t> (_mm256_movemask_epi8 (same)))
+                    return i + static_cast<size_t> (std::countr_zero (stops));
+            }
+
+            // Clear the upper halves before running legacy SSE code, which would otherwise stall on them.
+            _mm256_zeroupper();
+            return i + findMismatchSSE2 (p + i, q + i, length - i);
+        }
+
+        auto cpuHasAVX2() -> bool
+        {
+           #if defined (_MSC_VER)
+            int info[4];
+            __cpuid (info, 0);
+            if (info[0] < 7)
+                return false;
+
+            // AVX2 is only usable if the OS saves the YMM registers too.
+            __cpuid (info, 1);
+            const bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv (0) & 6) == 6;
+
+            __cpuidex (info, 7, 0);
+            return osSavesYmm && (info[1] & (1 << 5)) != 0;
+           #else
+            return __builtin_cpu_supports ("avx2");
+           #endif
+        }
+       #endif
+
+        auto selectMismatchFinder() -> MismatchFinder
+        {
+           #if DB_COLLATION_X64
+            return cpuHasAVX2() ? findMismatchAVX2 : findMismatchSSE2;
+           #else
+            return findMismatchScalar;
+           #endif
+        }
+
+        /** Index of the first byte of two string bodies where they differ or either has a quote or
+            backslash, or length if there is none. The implementation is picked for the CPU on first use.
+
+            Only the string collations use this. Plain byte order (REVID, and the fallback for malformed
+            JSON) stays on memcmp: revids are short and usually differ within the first few bytes, where the
+            call through the pointer costs more than the library's own vectorised memcmp. */
+        auto findMismatch (const char* p, const char* q, size_t length) -> size_t
+        {
+            // Most comparisons differ straight away, which isn't worth a call through the pointer.
+            if (length == 0 || isStop (p[0], q[0]))
+                return 0;
+
+            static const auto finder = selectMismatchFinder();
+            return finder (p, q, length);
+        }
+
+        auto isContinuationByte (const Cursor& s, size_t offset) -> bool
+        {
+            return offset < static_cast<size_t> (s.end - s.p) && (static_cast<unsigned char> (s.p[offset]) & 0xc0) == 0x80;
+        }
+
+        /** Moves two cursors inside string bodies past the bytes they have in common, stopping before any
+            quote or backslash and backing up to a UTF-8 character boundary. Identical bytes decode to
+            identical code points, so comparing from there gives the same result as from the start. */
+        auto skipCommonPrefix (Cursor& s1, Cursor& s2) -> void
+        {
+            const auto length = static_cast<size_t> (std::min (s1.end - s1.p, s2.end - s2.p));
+            auto skip = findMismatch (s1.p, s2.p, length);
+
+            while (skip > 0 && (isContinuationByte (s1, skip) || isContinuationByte (s2, skip)))
+                --skip;
+
+            s1.p += skip;
+            s2.p += skip;
+        }
+
+        /** JSON: both cursors sit on an opening quote. Primary differences anywhere in the strings win over
+            accents, and accents over case, so the first secondary and tertiary differences are only kept
+            aside until the end. */
+        auto compareUnicodeStrings (Cursor& a, Cursor& b) -> int
+        {
+            Cursor s1 { a.p + 1, a.end };
+            Cursor s2 { b.p + 1, b.end };
+            int secondary = 0, tertiary = 0;
+
+            // An expansion never spans code points, so the readers start out in step after the common prefix
+            skipCommonPrefix (s1, s2);
+            CollationElementReader r1 (s1), r2 (s2);
+
+            for (;;)
+            {
+                const auto e1 = r1.next();
+                const auto e2 = r2.next();
+
+                if (e1.primary < 0 || e2.primary < 0)
+                {
+                    if (e1.primary != e2.primary)
+                        return e1.primary < 0 ? -1 : 1;
+                    break;
+                }
+
+                if (e1.primary != e2.primary)
+                    return e1.primary < e2.primary ? -1 : 1;
+
+                if (e1.codePoint == e2.codePoint)
+                    continue;
+
+                if (secondary == 0 && e1.secondary != e2.secondary)
+                    secondary = e1.secondary < e2.secondary ? -1 : 1;
+
+                if (tertiary == 0)
+                    tertiary = compareTertiary (e1.codePoint, e2.codePoint);
+            }
+
+            a.p = s1.p;
+            b.p = s2.p;
+            return secondary != 0 ? secondary : tertiary;
+        }
+
+        /** JSON_ASCII: escapes are decoded, but code points compare as they are, without any folding. */
+        auto compareAsciiStrings (Cursor& a, Cursor& b) -> int
+        {
+            Cursor s1 { a.p + 1, a.end };
+            Cursor s2 { b.p + 1, b.end };
+
+            skipCommonPrefix (s1, s2);
+
+            for (;;)
+            {
+                const auto c1 = nextCodePoint (s1);
+                const auto c2 = nextCodePoint (s2);
+
+                if (c1 != c2)
+                    return c1 < c2 ? -1 : 1;
+
+                if (c1 < 0)
+                    break;
+            }
+
+            a.p = s1.p;
+            b.p = s2.p;
+            return 0;
+        }
+
+        /** JSON_RAW: the bytes between the quotes compare as they are, escapes and all. As long as both sides
+            are equal they are in the same escape state, so one flag covers both. */
+        auto compareRawStrings (Cursor& a, Cursor& b) -> int
+        {
+            const char* p = a.p + 1;
+            const char* q = b.p + 1;
+            bool escaped = false;
+
+            // The skipped bytes hold no backslash, so the escape state after them is still clear.
+            const auto common = findMismatch (p, q, static_cast<size_t> (std::min (a.end - p, b.end - q)));
+            p += common;
+            q += common;
+
+            for (;; ++p, ++q)
+            {
+                const bool end1 = p >= a.end || (*p == '"' && !escaped);
+                const bool end2 = q >= b.end || (*q == '"' && !escaped);
+
+                if (end1 || end2)
+                {
+                    if (end1 != end2)
+                        return end1 ? -1 : 1;
+                    break;
+                }
+
+                if (*p != *q)
+                    return static_cast<unsigned char> (*p) < static_cast<unsigned char> (*q) ? -1 : 1;
+
+                escaped = *p == '\\' && !escaped;
+            }
+
+            a.p = std::min (p + 1, a.end);
+            b.p = std::min (q + 1, b.end);
+            return 0;
+        }
+
+        //==============================================================================
+        template <Mode mode>
+        auto compareValues (Cursor& a, Cursor& b) -> int
+        {
+            int depth = 0;
+
+            do
+            {
+                const auto type1 = peekToken (a);
+                const auto type2 = peekToken (b);
+
+                if (type1 != type2)
+                    return rank<mode> (type1) < rank<mode> (type2) ? -1 : 1;
+
+                switch (type1)
+                {
+                    case Token::null:
+                    case Token::trueValue:
+                        advance (a, 4);
+                        advance (b, 4);
+                        break;
+
+                    case Token::falseValue:
+                        advance (a, 5);
+                        advance (b, 5);
+                        break;
+
+                    case Token::number:
+                        if (const int result = compareNumbers (readNumber (a), readNumber (b)))
+                            return result;
+                        break;
+
+                    case Token::string:
+                    {
+                        int result;
+
+                        if constexpr (mode == Mode::unicode)
+                            result = compareUnicodeStrings (a, b);
+                        else if constexpr (mode == Mode::ascii)
+                            result = compareAsciiStrings (a, b);
+                        else
+                            result = compareRawStrings (a, b);
+
+                        if (result != 0)
+                            return result;
+                        break;
+                    }
+
+                    case Token::array:
+                    case Token::object:
+                        ++a.p;
+                        ++b.p;
+                        ++depth;
+                        break;
+
+                    case Token::endArray:
+                    case Token::endObject:
+                        ++a.p;
+                        ++b.p;
+                        --depth;
+                        break;
+
+                    case Token::comma:
+                    case Token::colon:
+                        ++a.p;
+                        ++b.p;
+                        break;
+
+                    case Token::illegal:
+                        return malformed;
+                }
+            }
+            while (depth > 0);
+
+            return 0;
+        }
+
+        /** Generation of a revision ID, i.e. the number before its dash, or 0 if that isn't a valid number.
+            Only the exact span before the dash is parsed. */
+        auto parseGeneration (std::string_view revID, size_t dash) -> uint32_t
+        {
+            uint32_t generation = 0;
+            const auto [end, error] = std::from_chars (revID.data(), revID.data() + dash, generation);
+            return error == std::errc() && end == revID.data() + dash ? generation : 0;
+        }
+
+        auto compareBytes (std::string_view s1, std::string_view s2) -> int
+        {
+            const auto common = std::min (s1.size(), s2.size());
+            if (const int result = common > 0 ? std::memcmp (s1.data(), s2.data(), common) : 0)
+                return result < 0 ? -1 : 1;
+            return sign (static_cast<int64_t> (s1.size()) - static_cast<int64_t> (s2.size()));
+        }
+    }
+
+    template <Mode mode>
+    static auto collate (std::string_view json1, std::string_view json2) -> int
+    {
+        Cursor a { json1.data(), json1.data() + json1.size() };
+        Cursor b { json2.data(), json2.data() + json2.size() };
+
+        const int result = compareValues<mode> (a, b);
+        return result != malformed ? result : compareBytes (json1, json2);
+    }
+
+    template <Mode mode>
+    static auto collate (int len1, const void* chars1, int len2, const void* chars2) -> int
+    {
+        return collate<mode> (std::string_view (static_cast<const char*> (chars1), static_cast<size_t> (len1)),
+                              std::string_view (static_cast<const char*> (chars2), static_cast<size_t> (len2)));
+    }
+
+    auto getMismatchFinders() -> std::vector<std::pair<const char*, MismatchFinder>>
+    {
+        std::vector<std::pair<const char*, MismatchFinder>> finders { { "scalar", findMismatchScalar } };
+
+       #if DB_COLLATION_X64
+        finders.emplace_back ("SSE2", findMismatchSSE2);
+
+        if (cpuHasAVX2())
+            finders.emplace_back ("AVX2", findMismatchAVX2);
+       #endif
+
+        return finders;
+    }
+
+    auto collateJSON (std::string_view json1, std::string_view json2) -> int      { return collate<Mode::unicode> (json1, json2); }
+    auto collateJSONAscii (std::string_view json1, std::string_view json2) -> int { return collate<Mode::ascii> (json1, json2); }
+    auto collateJSONRaw (std::string_view json1, std::string_view json2) -> int   { return collate<Mode::raw> (json1, json2); }
+
+    auto collateJSON (void*, int len1, const void* chars1, int len2, const void* chars2) -> int
+    {
+        return collate<Mode::unicode> (len1, chars1, len2, chars2);
+    }
+
+    auto collateJSONAscii (void*, int len1, const void* chars1, int len2, const void* chars2) -> int
+    {
+        return collate<Mode::ascii> (len1, chars1, len2, chars2);
+    }
+
+    auto collateJSONRaw (void*, int len1, const void* chars1, int len2, const void* chars2) -> int
+    {
+        return collate<Mode::raw> (len1, chars1, len2, chars2);
+    }
+
+    auto collateRevIDs (std::string_view rev1, std::string_view rev2) -> int
+    {
+        const auto dash1 = rev1.find ('-');
+        const auto dash2 = rev2.find ('-');
+
+        // Generations with the same number of digits order the same numerically as they do as text, and
+        // the suffixes follow the dash at the same offset, so that case (every pair of single-digit
+        // generations included) is one byte compare. A missing dash is npos, so it is caught by the
+        // length check along with generations too long to be real.
+        if (dash1 == dash2 || dash1 > 8 || dash2 > 8)
+            return compareBytes (rev1, rev2);
+
+        const auto generation1 = parseGeneration (rev1, dash1);
+        const auto generation2 = parseGeneration (rev2, dash2);
+
+        if (generation1 == 0 || generation2 == 0)
+            return compareBytes (rev1, rev2);
+
+        if (generation1 != generation2)
+            return generation1 < generation2 ? -1 : 1;
+
+        return compareBytes (rev1.substr (dash1 + 1), rev2.substr (dash2 + 1));
+    }
+
+    auto collateRevIDs (void*, int len1, const void* chars1, int len2, const void* chars2) -> int
+    {
+        return collateRevIDs (std::string_view (static_cast<const char*> (chars1), static_cast<size_t> (len1)),
+                              std::string_view (static_cast<const char*> (chars2), static_cast<size_t> (len2)));
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace db {
+
+    /** Couchbase Lite's JSON collation, as used on the key column of every maps_N table.
+
+        Values of different types order as null < false < true < numbers < strings < arrays < objects.
+        Numbers compare by value, arrays and objects element by element (a shorter prefix sorts first) and
+        strings Unicode-aware, like the ICU root collation Couchbase Lite uses: accented Latin letters sort
+        with their base letter (é with e, æ as ae), then accents break ties, then case, lowercase first.
+        Letters outside Latin-1 and Latin Extended-A sort after all of those by code point, which is where
+        this differs from ICU; see jsonCollationVersion.
+
+        The comparison walks both JSON texts token by token and never builds a DOM or allocates.
+        Malformed input falls back to comparing the raw bytes.
+    */
+    auto collateJSON (std::string_view json1, std::string_view json2) -> int;
+
+    /** Changes whenever collateJSON's order does. Indexes sorted by a different order, Couchbase Lite's
+        own included, are rebuilt when a database is opened with a new version. */
+    constexpr int jsonCollationVersion = 1;
+
+    /** The "JSON_ASCII" variant: same type order, but strings compare by code point with no case folding. */
+    auto collateJSONAscii (std::string_view json1, std::string_view json2) -> int;
+
+    /** The "JSON_RAW" variant: types order as numbers < false < null < true < objects < arrays < strings,
+        and strings compare as the raw bytes between their quotes, without decoding escapes. */
+    auto collateJSONRaw (std::string_view json1, std::string_view json2) -> int;
+
+    /** sqlite3_create_collation callbacks for the "JSON", "JSON_ASCII" and "JSON_RAW" collations. */
+    auto collateJSON (void* context, int len1, const void* chars1, int len2, const void* chars2) -> int;
+    auto collateJSONAscii (void* context, int len1, const void* chars1, int len2, const void* chars2) -> int;
+    auto collateJSONRaw (void* context, int len1, const void* chars1, int len2, const void* chars2) -> int;
+
+    /** Couchbase Lite's revision ID collation (registered as "REVID"). A revision ID is a generation number,
+        a dash and a suffix: generations compare numerically, then suffixes as plain bytes. Anything that
+        isn't of that form, or has more than 8 generation digits, compares as plain bytes. */
+    auto collateRevIDs (std::string_view rev1, std::string_view rev2) -> int;
+
+    /** sqlite3_create_collation callback for the "REVID" collation. */
+    auto collateRevIDs (void* context, int len1, const void* chars1, int len2, const void* chars2) -> int;
+
+    using MismatchFinder = size_t (*) (const char* p, const char* q, size_t length);
+
+    /** Every implementation of the search the string collations use to skip the bytes two strings have in
+        common that this CPU can run, by name, the portable one first. Only there for the tests to check the
+        vectorised ones against it. */
+    auto getMismatchFinders() -> std::vector<std::pair<const char*, MismatchFinder>>;
+}
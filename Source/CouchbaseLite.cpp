@@ -1,404 +1,742 @@
 #include <ranges>
 #include <sqlite3.h>
+#include <carray.h>
 #include "CouchbaseLite.h"
-#include "nlohmann/json.hpp"
+#include "Collation.h"
+#include "Sha1.h"
+#include "SqliteStatement.h"
 
+#include <cassert>
 #include <string_view>
 #include <charconv>
 #include <sstream>
 #include <algorithm>
-#include <compare>
-
-// @echolox: Note sure about this for your version of Clang, I needed it back in the day
-#ifndef _MSC_VER
-
-std::strong_ordering cmp_icase(unsigned char x, unsigned char y)
-{
-    return std::toupper(x) <=> std::toupper(y);
-};
-
-namespace std
-{
-    template<class I1, class I2, class Cmp>
-    constexpr auto lexicographical_compare_three_way(I1 f1, I1 l1, I2 f2, I2 l2, Cmp comp)
-        -> decltype(comp(*f1, *f2))
-    {
-        using ret_t = decltype(comp(*f1, *f2));
-        static_assert(std::disjunction_v<
-                          std::is_same<ret_t, std::strong_ordering>,
-                          std::is_same<ret_t, std::weak_ordering>,
-                          std::is_same<ret_t, std::partial_ordering>>,
-                      "The return type must be a comparison category type.");
-     
-        bool exhaust1 = (f1 == l1);
-        bool exhaust2 = (f2 == l2);
-        for (; !exhaust1 && !exhaust2; exhaust1 = (++f1 == l1), exhaust2 = (++f2 == l2))
-            if (auto c = comp(*f1, *f2); c != 0)
-                return c;
-     
-        return !exhaust1 ? std::strong_ordering::greater:
-               !exhaust2 ? std::strong_ordering::less:
-                           std::strong_ordering::equal;
-    }
-}
-#endif
+#include <array>
+#include <optional>
+#include <unordered_set>
+
+// Implemented by 3rdParty/sqlite3/carray.c, built into the app through SqliteCarray.c. carray.h declares
+// sqlite3_carray_bind and its flags but not the init function, which is meant to be loaded as an extension.
+extern "C" int sqlite3_carray_init (sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi);
 
 namespace db {
-    static inline auto sgn (int n) -> int
+    auto getViewTableCreate (const int id) -> juce::String
     {
-        return n > 0 ? 1 : (n < 0 ? -1 : 0);
+        return juce::String ("CREATE TABLE IF NOT EXISTS 'maps_") + juce::String (id) + juce::String ("' (sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, key TEXT NOT NULL COLLATE JSON, value TEXT, fulltext_id INTEGER, bbox_id INTEGER, geokey BLOB)");
     }
 
-    static auto defaultCollate (const char* str1, int len1, const char* str2, int len2) -> int
+    auto getDatabaseFile (const juce::File& file) -> juce::File
     {
-        int result = memcmp (str1, str2, std::min (len1, len2));
-        return sgn (result ? result : (len1 - len2));
+        if (file.isDirectory())
+        {
+            return file.getChildFile("db.sqlite3");
+        }
+        return file;
     }
 
-    static auto parseDigits (const char* str, const char* end) -> unsigned
+    auto getFilePath (const juce::File& file) -> std::string
     {
-        unsigned result = 0;
-        for (; str < end; ++str)
-        {
-            if (!isdigit (*str))
-                return 0;
-            result = 10 * result + int((*str) - '0');
-        }
-        return result;
+        return getDatabaseFile (file).getFullPathName().toStdString();
     }
 
+    auto createCollation (sqlite3* connection, juce::StringRef collationName, int (*xCompare) (void*, int, const void*, int, const void*), void* pArgs = nullptr) -> int
+    {
+        return sqlite3_create_collation (connection, collationName, SQLITE_UTF8, pArgs, xCompare);
+    }
 
-    static int32_t defaultCollate( std::string_view rev1, std::string_view rev2 ) 
+    auto registerExtensions (sqlite3* connection) -> bool
     {
-        return defaultCollate(rev1.data(), rev1.length(), rev2.data(), rev2.length());
+        return createCollation (connection, "REVID", db::collateRevIDs) == SQLITE_OK
+            && createCollation (connection, "JSON", db::collateJSON) == SQLITE_OK
+            && createCollation (connection, "JSON_RAW", db::collateJSONRaw) == SQLITE_OK
+            && createCollation (connection, "JSON_ASCII", db::collateJSONAscii) == SQLITE_OK
+            && sqlite3_carray_init (connection, nullptr, nullptr) == SQLITE_OK;
     }
 
-    int32_t collateRevisions( void* data, int rev1_len, const void* rev1_data, int rev2_len, const void* rev2_data )
+    CouchbaseLiteDatabase::CouchbaseLiteDatabase (const juce::File& file, const OpenOptions& options) : dbFile (getDatabaseFile (file)), db (getFilePath (file))
     {
-        auto rev1 = std::string_view( ( const char* ) rev1_data, rev1_len );
-        auto rev2 = std::string_view( ( const char* ) rev2_data, rev2_len );
+        // The field indexes below are expressions over our functions and collations, so those come first
+        [[maybe_unused]] const bool registered = registerExtensions (db.connection().get());
+        assert( registered );
 
-        auto dash1 = rev1.find( '-' );
-        auto dash2 = rev2.find( '-' );
+        db << "CREATE TABLE IF NOT EXISTS docs (doc_id INTEGER PRIMARY KEY, docid TEXT UNIQUE NOT NULL, expiry_timestamp INTEGER)";
+        db << "CREATE TABLE IF NOT EXISTS info (key TEXT PRIMARY KEY, value TEXT)";
+        db << "CREATE TABLE IF NOT EXISTS localdocs (docid TEXT UNIQUE NOT NULL, revid TEXT NOT NULL COLLATE REVID, json BLOB)";
+        db << "CREATE TABLE IF NOT EXISTS revs (sequence INTEGER PRIMARY KEY AUTOINCREMENT, doc_id INTEGER NOT NULL REFERENCES docs(doc_id) ON DELETE CASCADE, revid TEXT NOT NULL COLLATE REVID, parent INTEGER REFERENCES revs(sequence) ON DELETE SET NULL, current BOOLEAN, deleted BOOLEAN DEFAULT 0, json BLOB, no_attachments BOOLEAN, doc_type TEXT, UNIQUE (doc_id, revid))";
+        db << "CREATE TABLE IF NOT EXISTS views (view_id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL, version TEXT, lastsequence INTEGER DEFAULT 0, total_docs INTEGER DEFAULT -1)";
+
+        if (options.createTypeIndex)
+            db << "CREATE INDEX IF NOT EXISTS revs_by_type ON revs(doc_type, current, doc_id)";
+
+        for (auto& path : options.indexedFields)
+            createFieldIndex (path);
+
+        // An index only stays usable if it is sorted the way the collation compares now
+        int indexedCollation = 0;
+        db << "SELECT CAST(value AS INTEGER) FROM info WHERE key = 'ndls_json_collation'" >> [&] (const int version) { indexedCollation = version; };
 
-        if ( ( dash1 == 1 && dash2 == 1 )
-            || dash1 > 8 || dash2 > 8
-            || dash1 == std::string_view::npos || dash2 == std::string_view::npos )
+        if (indexedCollation != jsonCollationVersion)
         {
-            return defaultCollate( rev1, rev2 );
+            db << "REINDEX JSON";
+            db << "INSERT OR REPLACE INTO info (key, value) VALUES ('ndls_json_collation', ?)" << std::to_string (jsonCollationVersion);
         }
 
-        auto gen1_str = rev1.substr( 0, dash1 );
-        auto gen2_str = rev2.substr( 0, dash2 );
+        db << "SELECT view_id FROM views;" >> [&] (const int id)
+        {
+            db << getViewTableCreate (id).toStdString();
+            createViewTriggers (db.connection().get(), id);
+        };
+    }
 
-        int gen1, gen2;
-        try
+    auto CouchbaseLiteDatabase::getAllDocumentIds() -> juce::StringArray
+    {
+        juce::StringArray docIds;
+
+        // docid is UNIQUE, so there is nothing to dedupe here
+        *statements.acquire ("SELECT doc_id, docid FROM docs") >> [&] (const int doc_id, const std::string docId)
         {
-            gen1 = std::stoi( gen1_str.data( ) );
-            gen2 = std::stoi( gen2_str.data( ) );
-        }
-        catch ( std::exception& e )
+            docIds.add (docId);
+        };
+
+        return docIds;
+    }
+
+    auto CouchbaseLiteDatabase::getAllDocumentIds (juce::String type) -> juce::StringArray
+    {
+        juce::StringArray docIds;
+
+        // A document with conflicting leaves has more than one current revision, so the same
+        // doc_id can come back several times. Dedupe on the integer key rather than the string.
+        std::unordered_set<sqlite3_int64> seen;
+
+        *statements.acquire ("SELECT revs.doc_id, docs.docid FROM revs JOIN docs ON docs.doc_id = revs.doc_id WHERE revs.doc_type = (?) AND revs.current = 1")
+           << type.toStdString()
+           >> [&] (const sqlite3_int64 doc_id, const std::string docId)
         {
-            auto error = e.what( );
+            if (seen.insert (doc_id).second)
+                docIds.add (juce::String (docId));
+        };
 
-            return defaultCollate( rev1, rev2 );
-        }
+        return docIds;
+    }
+
+    static const juce::String localDocIdPrefix = "_local/";
+
+    auto CouchbaseLiteDatabase::getLocalDocument (const juce::String& docId) -> juce::var
+    {
+        const juce::String localDocId = localDocIdPrefix + docId;
+        
+        juce::var document;
+        *statements.acquire ("SELECT docid, revid, json FROM localdocs WHERE docid = (?)") << localDocId.toStdString() >> [&](const std::string docId, const std::string revId, const std::string json) {
+            document = juce::JSON::parse (json);
+            if (auto obj = document.getDynamicObject())
+            {
+                obj->setProperty ("_rev", juce::String (revId));
+                obj->setProperty ("_id", juce::String (docId).replaceFirstOccurrenceOf(localDocIdPrefix, ""));
+            }
+        };
+        return document;
+    }
 
-        if ( gen1 == 0 || gen2 == 0 )
+    std::vector<char> toSqliteBlob(const std::string& string)
+    {
+        return { string.begin(), string.end() };
+    }
+
+    auto CouchbaseLiteDatabase::setLocalDocument (juce::var document) -> int
+    {
+        if(document.hasProperty("_id") && document.hasProperty("_rev"))
         {
-            return defaultCollate( rev1, rev2 );
-        }
+            juce::String docId = localDocIdPrefix + document["_id"].toString();
+            juce::String revId = document["_rev"];
+            if (auto obj = document.getDynamicObject())
+            {
+                obj->removeProperty("_id");
+                obj->removeProperty("_rev");
+            }
 
-        const auto difference = gen1 - gen2;
-        const auto result = difference > 0 ? 1 : ( difference < 0 ? -1 : 0 );
-        if ( result != 0 )
+            auto jsonBlob = toSqliteBlob(juce::JSON::toString(document, true).toStdString());
+            (*statements.acquire ("INSERT INTO localdocs (docid, revid, json) values (?,?,?) ON CONFLICT DO UPDATE SET json=? WHERE docid=?") << docId.toStdString() << revId.toStdString() << jsonBlob << jsonBlob << docId.toStdString()).execute();
+            
+            int const rows_modified = db.rows_modified();
+            DBG(db.rows_modified() << " Rows Modified");
+            return rows_modified;
+        }
+        else
         {
-            return result;
+            jassertfalse;
+            return 0;
         }
+    }
+
+    auto CouchbaseLiteDatabase::getDocuments (const juce::StringArray& docIds) -> juce::Array<juce::var>
+    {
+        juce::Array<juce::var> results;
 
-        auto suffix1 = dash1 + 1;
-        auto suffix2 = dash2 + 1;
+        if (docIds.isEmpty())
+            return results;
 
-        if ( rev1.size( ) > suffix1 && rev2.size( ) > suffix2 )
+        // carray wants a plain char* array, which has to outlive the statement
+        std::vector<std::string> ids;
+        std::vector<const char*> idPointers;
+        ids.reserve (static_cast<size_t> (docIds.size()));
+        idPointers.reserve (static_cast<size_t> (docIds.size()));
+
+        for (auto& docId : docIds)
+            idPointers.push_back (ids.emplace_back (docId.toStdString()).c_str());
+
+        // One statement for the whole batch. Rows come back in the order of the requested ids; for a
+        // document with several current revisions the last row wins, and they are sorted so that is the
+        // same winner getDocument picks.
+        Statement statement (db.connection().get(),
+                             "SELECT ids.rowid, docs.docid, revs.revid, revs.json, revs.doc_type FROM carray(?1) AS ids"
+                             " JOIN docs ON docs.docid = ids.value"
+                             " JOIN revs ON revs.doc_id = docs.doc_id AND revs.current = 1"
+                             " ORDER BY ids.rowid, revs.deleted DESC, revs.revid");
+
+        Statement::check (db.connection().get(),
+                          sqlite3_carray_bind (statement.get(), 1, idPointers.data(), static_cast<int> (idPointers.size()), CARRAY_TEXT, SQLITE_STATIC));
+
+        sqlite3_int64 previousRow = -1;
+        bool previousAdded = false;
+
+        while (statement.step())
         {
-            // Compare suffixes:
-            return defaultCollate( rev1.substr( suffix1 ), rev2.substr( suffix2 ) );
+            const auto row = statement.getInt64 (0);
+            auto doc = makeDocument (toString (statement.getText (3)), toString (statement.getText (1)), toString (statement.getText (2)), toString (statement.getText (4)));
+
+            if (row == previousRow && previousAdded)
+                results.removeLast();
+
+            previousAdded = doc.isObject();
+            previousRow = row;
+
+            if (previousAdded)
+                results.add (doc);
         }
 
-        // Invalid format, fall back to compare as plain text:
-        return defaultCollate( rev1, rev2 );
+        return results;
     }
 
-    template<typename Numeric>
-    static int32_t threeWayCompare(const Numeric& a, const Numeric& b)
+    /** Concatenates string literals at compile time, for statements that share a clause. */
+    template <size_t... sizes>
+    static constexpr auto joinSql (const char (&... parts)[sizes])
     {
-        const auto difference = a - b;
-        return difference > 0 ? 1 : ( difference < 0 ? -1 : 0 );
+        std::array<char, (sizes + ... + 1) - sizeof... (sizes)> sql {};
+        auto end = sql.begin();
+        ((end = std::copy_n (parts, sizes - 1, end)), ...);
+        return sql;
     }
 
-    int32_t collateJSON( void* data, int js1_len, const void* js1_data, int js2_len, const void* js2_data )
-    {
-        auto js1 = std::string_view( ( const char* ) js1_data, js1_len );
-        auto js2 = std::string_view( ( const char* ) js2_data, js2_len );
+    // Current revisions of one type. When a document has several current revisions only the winner is
+    // returned (live before deleted, then the highest revid), so that each document shows up once
+    // without buffering rows.
+    static constexpr char currentOfTypeFrom[] = " FROM revs JOIN docs ON docs.doc_id = revs.doc_id"
+                                                " WHERE revs.doc_type = ?1 AND revs.current = 1"
+                                                " AND NOT EXISTS (SELECT 1 FROM revs AS better WHERE better.doc_id = revs.doc_id AND better.current = 1"
+                                                " AND (better.deleted < revs.deleted OR (better.deleted = revs.deleted AND better.revid > revs.revid)))";
 
-        int64_t i1,i2;
-#ifdef _MSC_VER
-        auto r1 = std::from_chars( js1.data( ), js1.data( ) + js1.size( ), i1 );
-        auto r2 = std::from_chars( js2.data( ), js2.data( ) + js2.size( ), i2 );
-#else
-        auto r1 = std::from_chars<int64_t>(js1.begin(), js1.end(), i1);
-        auto r2 = std::from_chars<int64_t>(js2.begin(), js2.end(), i2);
-#endif
+    static constexpr auto currentRevisionsOfType   = joinSql ("SELECT docs.docid, revs.revid, revs.json, revs.doc_type", currentOfTypeFrom);
+    static constexpr auto currentDocumentIdsOfType = joinSql ("SELECT docs.docid", currentOfTypeFrom);
 
-        auto no_error = std::errc();
-        
-        if (r1.ec == no_error && r2.ec == no_error)
+    auto CouchbaseLiteDatabase::forEachRevision (const juce::String& type, const std::function<bool (const RevisionRow&)>& callback) -> int
+    {
+        // Leased from the cache, so the hot path doesn't prepare on every call; a callback that starts
+        // another scan of its own gets a fresh statement
+        auto statement = statements.acquireStatement (currentRevisionsOfType.data());
+        statement->bind (1, type.toStdString());
+
+        int visited = 0;
+        while (statement->step())
         {
-            // We got integers!
-            return threeWayCompare( i1, i2 );
+            ++visited;
+            const RevisionRow row { statement->getText (0), statement->getText (1), statement->getText (2), statement->getText (3) };
+            if (!callback (row))
+                break;
         }
 
-        // If they aren't integers let's try strings.
+        return visited;
+    }
 
-        if ( js1.starts_with( "\"" ) )
+    auto CouchbaseLiteDatabase::forEachDocument (const juce::String& type, const std::function<bool (const juce::var&)>& callback) -> int
+    {
+        return forEachRevision (type, [&] (const RevisionRow& row)
         {
-            const auto cmp = std::lexicographical_compare_three_way( js1.begin( ), js1.end( ), js2.begin( ), js2.end( ) );
-            return ( cmp < 0 ) ? -1 : ( ( cmp == 0 ) ? 0 : 1 );
-        }
-        
-        // The disappointments continue: Clang doesn't have the std::from_chars overload for double or float...
-        // So we won't handle floats and doubles for now....
-
-        const nlohmann::json d1 = nlohmann::json::parse(js1);
-        const nlohmann::json d2 = nlohmann::json::parse(js2);
+            return callback (makeDocument (toString (row.json), toString (row.docId), toString (row.revId), toString (row.type)));
+        });
+    }
 
-        bool canCompare = d1 && d2;
+    template <typename Document>
+    static auto forEachTypedDocument (CouchbaseLiteDatabase& database, const std::function<bool (const Document&)>& callback) -> int
+    {
+        Document document;
 
-        if ( canCompare && (d1.type( ) == d2.type( ) ) )
+        return database.forEachRevision (Document::typeName, [&] (const RevisionRow& row)
         {
-            if ( d1.is_number_integer() )
-            {
-                return threeWayCompare( std::int64_t(d1), std::int64_t(d2) );
-            }
-            else if ( d1.is_number_unsigned( ) )
+            if (! decode (row.json, document))
             {
-                return threeWayCompare( std::uint64_t( d1 ), std::uint64_t( d2 ) );
-            }
-            else if ( d1.is_number_float( ) )
-            {
-                return threeWayCompare( double(d1), double(d2) );
-            }
-            else if ( d1.is_boolean( ) )
-            {
-                return threeWayCompare( bool(d1), bool(d2) );
-            }
-            else if ( d1.is_array( ) )
-            {
-                assert( false ); // Not yet implemented
+                jassertfalse;
+                return true;
             }
-        }
 
-        assert( false ); // wtf is this data?
-        return threeWayCompare( js1.size( ), js2.size( ) );
+            document.docId.assign (row.docId);
+            document.revId.assign (row.revId);
+            return callback (document);
+        });
     }
 
+    auto CouchbaseLiteDatabase::forEachRiff (const std::function<bool (const Riff&)>& callback) -> int
+    {
+        return forEachTypedDocument (*this, callback);
+    }
 
-    /* A proper revision ID consists of a generation number, a hyphen, and an arbitrary suffix.
-       Compare the generation numbers numerically, and then the suffixes lexicographically.
-       If either string isn't a proper rev ID, fall back to lexicographic comparison. */
-    auto CBLCollateRevIDs (void* context,
-                           int len1,
-                           const void* chars1,
-                           int len2,
-                           const void* chars2) -> int
+    auto CouchbaseLiteDatabase::forEachLoop (const std::function<bool (const Loop&)>& callback) -> int
     {
-        const char* rev1 = static_cast<const char*> (chars1);
-        const char* rev2 = static_cast<const char*> (chars2);
+        return forEachTypedDocument (*this, callback);
+    }
 
-        const char* dash1 = static_cast<const char*> (memchr (rev1, '-', len1));
-        const char* dash2 = static_cast<const char*> (memchr (rev2, '-', len2));
+    auto CouchbaseLiteDatabase::forEachDocumentId (const juce::String& type, const std::function<bool (const juce::String&)>& callback) -> int
+    {
+        auto statement = statements.acquireStatement (currentDocumentIdsOfType.data());
+        statement->bind (1, type.toStdString());
 
-        if ((dash1 == rev1 + 1 && dash2 == rev2 + 1)
-            || dash1 > rev1 + 8 || dash2 > rev2 + 8
-            || dash1 == nullptr || dash2 == nullptr)
+        int visited = 0;
+        while (statement->step())
         {
-            // Single-digit generation #s, or improper rev IDs; just compare as plain text:
-            return defaultCollate (rev1, len1, rev2, len2);
+            ++visited;
+            if (!callback (toString (statement->getText (0))))
+                break;
         }
-        // Parse generation numbers. If either is invalid, revert to default collation:
-        int gen1 = parseDigits (rev1, dash1);
-        int gen2 = parseDigits (rev2, dash2);
-        if (!gen1 || !gen2)
-            return defaultCollate (rev1, len1, rev2, len2);
 
-        // Compare generation numbers; if they match, compare suffixes:
-        int result = sgn (gen1 - gen2);
-        return result ? result : defaultCollate (dash1 + 1, len1 - (int)(dash1 + 1 - rev1), dash2 + 1, len2 - (int)(dash2 + 1 - rev2));
+        return visited;
     }
 
-    auto getViewTableCreate (const int id) -> juce::String
+    static auto quoteSqlLiteral (const juce::String& text) -> juce::String
     {
-        return juce::String ("CREATE TABLE IF NOT EXISTS 'maps_") + juce::String (id) + juce::String ("' (sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, key TEXT NOT NULL COLLATE JSON, value TEXT, fulltext_id INTEGER, bbox_id INTEGER, geokey BLOB)");
+        return "'" + text.replace ("'", "''") + "'";
     }
 
-    auto getDatabaseFile (const juce::File& file) -> juce::File
+    /** The path is spliced into the SQL as a literal rather than bound, since SQLite only uses an
+        expression index when the expression in the query is the same, literal for literal. revs.json is a
+        BLOB, which SQLite 3.45 and later may take for JSONB, hence the cast. */
+    static auto jsonField (const juce::String& path, juce::StringRef column, juce::StringRef function = "json_extract") -> juce::String
     {
-        if (file.isDirectory())
+        const auto fullPath = path.startsWithChar ('$') ? path : "$." + path;
+        return juce::String (function) + "(CAST(" + column + " AS TEXT), " + quoteSqlLiteral (fullPath) + ")";
+    }
+
+    static auto toSql (FieldFilter::Operator op) -> const char*
+    {
+        switch (op)
         {
-            return file.getChildFile("db.sqlite3");
+            case FieldFilter::Operator::equal:          return "=";
+            case FieldFilter::Operator::notEqual:       return "!=";
+            case FieldFilter::Operator::less:           return "<";
+            case FieldFilter::Operator::lessOrEqual:    return "<=";
+            case FieldFilter::Operator::greater:        return ">";
+            case FieldFilter::Operator::greaterOrEqual: return ">=";
         }
-        return file;
+
+        jassertfalse;
+        return "=";
     }
 
-    auto getFilePath (const juce::File& file) -> std::string
+    static auto testsForNull (const FieldFilter& filter) -> bool
     {
-        return getDatabaseFile (file).getFullPathName().toStdString();
+        return filter.value.isVoid() && (filter.op == FieldFilter::Operator::equal || filter.op == FieldFilter::Operator::notEqual);
     }
 
-    auto createCollation (sqlite::database& db, juce::StringRef collationName, int (*xCompare) (void*, int, const void*, int, const void*), void* pArgs = nullptr) -> int
+    static auto bindValue (Statement& statement, int index, const juce::var& value) -> void
     {
-        return sqlite3_create_collation (db.connection().get(), collationName, SQLITE_UTF8, pArgs, xCompare);
+        if (value.isBool() || value.isInt() || value.isInt64())
+            statement.bind (index, static_cast<sqlite3_int64> (static_cast<juce::int64> (value)));
+        else if (value.isDouble())
+            statement.bind (index, static_cast<double> (value));
+        else if (value.isVoid() || value.isUndefined())
+            statement.bindNull (index);
+        else
+            statement.bind (index, value.toString().toStdString());
     }
 
-    CouchbaseLiteDatabase::CouchbaseLiteDatabase (const juce::File& file) : dbFile (getDatabaseFile (file)), db (getFilePath (file))
+    /** A json_extract column, with the json_type column that follows it telling true/false and
+        objects/arrays (which json_extract returns as 1/0 and as JSON text) apart. */
+    static auto getFieldValue (const Statement& statement, int column) -> juce::var
     {
-        db << "CREATE TABLE IF NOT EXISTS docs (doc_id INTEGER PRIMARY KEY, docid TEXT UNIQUE NOT NULL, expiry_timestamp INTEGER)";
-        db << "CREATE TABLE IF NOT EXISTS info (key TEXT PRIMARY KEY, value TEXT)";
-        db << "CREATE TABLE IF NOT EXISTS localdocs (docid TEXT UNIQUE NOT NULL, revid TEXT NOT NULL COLLATE REVID, json BLOB)";
-        db << "CREATE TABLE IF NOT EXISTS revs (sequence INTEGER PRIMARY KEY AUTOINCREMENT, doc_id INTEGER NOT NULL REFERENCES docs(doc_id) ON DELETE CASCADE, revid TEXT NOT NULL COLLATE REVID, parent INTEGER REFERENCES revs(sequence) ON DELETE SET NULL, current BOOLEAN, deleted BOOLEAN DEFAULT 0, json BLOB, no_attachments BOOLEAN, doc_type TEXT, UNIQUE (doc_id, revid))";
-        db << "CREATE TABLE IF NOT EXISTS views (view_id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL, version TEXT, lastsequence INTEGER DEFAULT 0, total_docs INTEGER DEFAULT -1)";
+        const auto jsonType = statement.getText (column + 1);
 
-        /*sqlite3_create_collation(dbHandle, "JSON", SQLITE_UTF8,
-                                 kCBLCollateJSON_Unicode, CBLCollateJSON);
-        sqlite3_create_collation(dbHandle, "JSON_RAW", SQLITE_UTF8,
-                                 kCBLCollateJSON_Raw, CBLCollateJSON);
-        sqlite3_create_collation(dbHandle, "JSON_ASCII", SQLITE_UTF8,
-                                 kCBLCollateJSON_ASCII, CBLCollateJSON);*/
-        int result;
-        result = createCollation (db, "REVID", CBLCollateRevIDs);
-        assert( result == SQLITE_OK );
-        result = createCollation (db, "JSON", db::collateJSON);
-        assert( result == SQLITE_OK );
+        if (jsonType == "true")                         return true;
+        if (jsonType == "false")                        return false;
+        if (jsonType == "object" || jsonType == "array") return juce::JSON::parse (toString (statement.getText (column)));
 
-        db << "SELECT view_id FROM views;" >> [&] (const int id)
+        switch (statement.getType (column))
         {
-            db << getViewTableCreate (id).toStdString();
-        };
+            case SQLITE_INTEGER: return static_cast<juce::int64> (statement.getInt64 (column));
+            case SQLITE_FLOAT:   return statement.getDouble (column);
+            case SQLITE_TEXT:    return toString (statement.getText (column));
+            default:             return {};
+        }
     }
 
-    auto CouchbaseLiteDatabase::getAllDocumentIds() -> juce::StringArray
+    auto CouchbaseLiteDatabase::selectFields (const juce::String& type,
+                                              const juce::StringArray& paths,
+                                              const juce::Array<FieldFilter>& filters,
+                                              const std::function<bool (const juce::String&, const juce::Array<juce::var>&)>& callback) -> int
     {
-        juce::StringArray docIds;
+        juce::String sql ("SELECT docs.docid");
+
+        for (auto& path : paths)
+            sql << ", " << jsonField (path, "revs.json") << ", " << jsonField (path, "revs.json", "json_type");
+
+        sql << currentOfTypeFrom;
 
-        db << "SELECT doc_id, docid FROM docs" >> [&] (const int doc_id, const std::string docId)
+        int parameter = 2;
+        for (auto& filter : filters)
         {
-            docIds.addIfNotAlreadyThere (docId);
-        };
+            sql << " AND " << jsonField (filter.path, "revs.json");
 
-        return docIds;
+            if (testsForNull (filter))
+                sql << (filter.op == FieldFilter::Operator::equal ? " IS NULL" : " IS NOT NULL");
+            else
+                sql << " " << toSql (filter.op) << " ?" << parameter++;
+        }
+
+        Statement statement (db.connection().get(), sql.toStdString());
+        statement.bind (1, type.toStdString());
+
+        parameter = 2;
+        for (auto& filter : filters)
+            if (! testsForNull (filter))
+                bindValue (statement, parameter++, filter.value);
+
+        juce::Array<juce::var> values;
+        int visited = 0;
+
+        while (statement.step())
+        {
+            ++visited;
+
+            values.clearQuick();
+            for (int i = 0; i < paths.size(); ++i)
+                values.add (getFieldValue (statement, 1 + 2 * i));
+
+            if (!callback (toString (statement.getText (0)), values))
+                break;
+        }
+
+        return visited;
     }
 
-    auto CouchbaseLiteDatabase::getAllDocumentIds (juce::String type) -> juce::StringArray
+    auto CouchbaseLiteDatabase::createFieldIndex (const juce::String& path) -> void
     {
-        juce::StringArray docIds;
+        const auto name = "revs_by_field_" + path.retainCharacters ("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_")
+                        + "_" + juce::String::toHexString (path.hashCode());
+
+        db << ("CREATE INDEX IF NOT EXISTS " + name + " ON revs(doc_type, " + jsonField (path, "json") + ") WHERE current = 1").toStdString();
+    }
+
+    auto CouchbaseLiteDatabase::getDocument (const juce::String& docId) -> juce::var
+    {
+        juce::var document;
 
-        db << "SELECT doc_id FROM revs WHERE doc_type = (?) AND current = 1" << type.toStdString() >> [&] (const int doc_id)
+        *statements.acquire ("SELECT doc_id, docid FROM docs WHERE docid = (?)") << docId.toStdString() >> [&] (const int doc_id, const std::string docId)
         {
-            db << "SELECT docid from docs WHERE doc_id = (?)" << doc_id >> [&] (const std::string docId)
+            *statements.acquire ("SELECT doc_id, revid, json, doc_type FROM revs WHERE doc_id = (?) AND current = 1 ORDER BY deleted, revid DESC LIMIT 1") << doc_id >> [&] (const int doc_id, const std::string revId, const std::string json, const std::string type)
             {
-                docIds.addIfNotAlreadyThere (juce::String (docId));
+                document = makeDocument (json, docId, revId, type);
             };
         };
 
-        return docIds;
+        return document;
     }
 
-    static const juce::String localDocIdPrefix = "_local/";
+    auto CouchbaseLiteDatabase::getDocumentView (const juce::String& docId) -> DocumentView
+    {
+        // Same choice as getDocument when a document has several current revisions
+        auto statement = std::make_unique<Statement> (db.connection().get(),
+                                                      "SELECT docs.docid, revs.revid, revs.json, revs.doc_type FROM docs"
+                                                      " JOIN revs ON revs.doc_id = docs.doc_id"
+                                                      " WHERE docs.docid = ?1 AND revs.current = 1"
+                                                      " ORDER BY revs.deleted, revs.revid DESC LIMIT 1");
+        statement->bind (1, docId.toStdString());
+
+        if (! statement->step())
+            return {};
+
+        return DocumentView (std::move (statement));
+    }
 
-    auto CouchbaseLiteDatabase::getLocalDocument (const juce::String& docId) -> juce::var
+    auto CouchbaseLiteDatabase::getRevisionTree (const juce::String& docId) -> RevisionTree
     {
-        const juce::String localDocId = localDocIdPrefix + docId;
-        
-        juce::var document;
-        db << "SELECT docid, revid, json FROM localdocs WHERE docid = (?)" << localDocId.toStdString() >> [&](const std::string docId, const std::string revId, const std::string json) {
-            document = juce::JSON::parse (json);
-            if (auto obj = document.getDynamicObject())
+        // A parent is always stored before its children, so in sequence order every parent has been
+        // seen by the time a child refers to it
+        Statement statement (db.connection().get(), "SELECT revs.sequence, revs.parent, revs.revid, revs.deleted, revs.current FROM docs"
+                                                    " JOIN revs ON revs.doc_id = docs.doc_id"
+                                                    " WHERE docs.docid = ?1 ORDER BY revs.sequence");
+        statement.bind (1, docId.toStdString());
+
+        RevisionTree tree;
+        tree.docId = docId.toStdString();
+
+        while (statement.step())
+        {
+            const auto revId = statement.getText (2);
+
+            RevisionTree::Node node;
+            node.sequence = statement.getInt64 (0);
+            node.revIdStart = static_cast<uint32_t> (tree.revIds.size());
+            node.revIdLength = static_cast<uint32_t> (revId.size());
+            node.deleted = statement.getInt64 (3) != 0;
+            node.current = statement.getInt64 (4) != 0;
+
+            if (! statement.isNull (1))
             {
-                obj->setProperty ("_rev", juce::String (revId));
-                obj->setProperty ("_id", juce::String (docId).replaceFirstOccurrenceOf(localDocIdPrefix, ""));
+                const auto parent = std::lower_bound (tree.nodes.begin(), tree.nodes.end(), statement.getInt64 (1),
+                                                      [] (const RevisionTree::Node& n, juce::int64 sequence) { return n.sequence < sequence; });
+
+                if (parent != tree.nodes.end() && parent->sequence == statement.getInt64 (1))
+                    node.parent = static_cast<int> (parent - tree.nodes.begin());
             }
-        };
-        return document;
-    }
 
-    std::vector<char> toSqliteBlob(const std::string& string)
-    {
-        return { string.begin(), string.end() };
+            tree.revIds.append (revId);
+            tree.nodes.push_back (node);
+        }
+
+        return tree;
     }
 
-    auto CouchbaseLiteDatabase::setLocalDocument (juce::var document) -> int
+    auto CouchbaseLiteDatabase::findConflicts() -> std::vector<DocumentConflict>
     {
-        if(document.hasProperty("_id") && document.hasProperty("_rev"))
+        // The GROUP BY and the outer scan both read only revs_current (doc_id, current desc, deleted,
+        // revid desc), which also hands back each document's leaves winner first
+        Statement statement (db.connection().get(), "SELECT revs.doc_id, docs.docid, revs.revid FROM revs JOIN docs ON docs.doc_id = revs.doc_id"
+                                                    " WHERE revs.current = 1 AND revs.deleted = 0 AND revs.doc_id IN"
+                                                    " (SELECT doc_id FROM revs WHERE current = 1 AND deleted = 0 GROUP BY doc_id HAVING COUNT(*) > 1)"
+                                                    " ORDER BY revs.doc_id, revs.revid DESC");
+
+        std::vector<DocumentConflict> conflicts;
+        sqlite3_int64 previousDocument = -1;
+
+        while (statement.step())
         {
-            juce::String docId = localDocIdPrefix + document["_id"].toString();
-            juce::String revId = document["_rev"];
-            if (auto obj = document.getDynamicObject())
+            if (statement.getInt64 (0) != previousDocument)
             {
-                obj->removeProperty("_id");
-                obj->removeProperty("_rev");
+                previousDocument = statement.getInt64 (0);
+                conflicts.push_back ({ std::string (statement.getText (1)), {} });
             }
 
-            auto jsonBlob = toSqliteBlob(juce::JSON::toString(document, true).toStdString());
-            db << "INSERT INTO localdocs (docid, revid, json) values (?,?,?) ON CONFLICT DO UPDATE SET json=? WHERE docid=?" << docId.toStdString() << revId.toStdString() << jsonBlob << jsonBlob << docId.toStdString();
-            
-            int const rows_modified = db.rows_modified();
-            DBG(db.rows_modified() << " Rows Modified");
-            return rows_modified;
+            conflicts.back().revIds.emplace_back (statement.getText (2));
         }
-        else
+
+        return conflicts;
+    }
+
+    /** The ID of a deletion on top of a revision: the next generation, and a digest of the parent so that
+        everyone closing the same branch comes up with the same revision. */
+    static auto getTombstoneRevId (std::string_view parentRevId) -> std::string
+    {
+        int generation = 0;
+        std::from_chars (parentRevId.data(), parentRevId.data() + parentRevId.size(), generation);
+
+        const auto input = std::string (parentRevId) + "_deleted";
+        const auto sha1 = computeSha1 (std::as_bytes (std::span (input)));
+
+        static constexpr char hexDigits[] = "0123456789abcdef";
+        auto revId = std::to_string (generation + 1) + "-";
+
+        for (auto byte : sha1)
         {
-            jassertfalse;
-            return 0;
+            revId += hexDigits[byte >> 4];
+            revId += hexDigits[byte & 15];
         }
+
+        return revId;
     }
 
-    auto CouchbaseLiteDatabase::getDocuments (const juce::StringArray& docIds) -> juce::Array<juce::var>
+    auto CouchbaseLiteDatabase::resolveConflicts (const std::vector<DocumentConflict>& conflicts) -> int
     {
-        juce::Array<juce::var> results;
+        auto connection = db.connection().get();
+        Transaction transaction (connection);
 
-        for (auto& docId : docIds)
+        Statement leaves (connection, "SELECT revs.sequence, revs.doc_id, revs.revid, revs.doc_type FROM docs JOIN revs ON revs.doc_id = docs.doc_id"
+                                      " WHERE docs.docid = ?1 AND revs.current = 1 AND revs.deleted = 0 ORDER BY revs.revid DESC");
+
+        // The tombstone keeps the branch's doc_type, so scans by type still see the document as one of theirs
+        Statement tombstone (connection, "INSERT INTO revs (doc_id, revid, parent, current, deleted, json, no_attachments, doc_type)"
+                                         " VALUES (?1, ?2, ?3, 1, 1, ?4, 1, ?5)");
+        Statement retire (connection, "UPDATE revs SET current = 0 WHERE sequence = ?1");
+
+        static constexpr std::string_view emptyBody = "{}";
+
+        struct Leaf
         {
-            auto doc = getDocument (docId);
-            if (doc.isObject())
+            sqlite3_int64 sequence = 0;
+            sqlite3_int64 docId = 0;
+            std::string revId;
+            std::optional<std::string> docType;
+        };
+
+        std::vector<Leaf> losers;
+        int closed = 0;
+
+        for (auto& conflict : conflicts)
+        {
+            // Everything after the first (winning) leaf loses
+            losers.clear();
+            leaves.reset();
+            leaves.bind (1, conflict.docId);
+
+            for (bool winner = true; leaves.step(); winner = false)
+                if (! winner)
+                    losers.push_back ({ leaves.getInt64 (0), leaves.getInt64 (1), std::string (leaves.getText (2)),
+                                        leaves.isNull (3) ? std::nullopt : std::optional<std::string> (leaves.getText (3)) });
+
+            leaves.reset();
+
+            for (auto& loser : losers)
             {
-                results.add (doc);
+                tombstone.reset();
+                tombstone.bind (1, loser.docId).bind (2, getTombstoneRevId (loser.revId)).bind (3, loser.sequence)
+                         .bindBlob (4, emptyBody.data(), static_cast<int> (emptyBody.size()));
+
+                if (loser.docType.has_value())
+                    tombstone.bind (5, *loser.docType);
+                else
+                    tombstone.bindNull (5);
+
+                tombstone.step();
+
+                retire.reset();
+                retire.bind (1, loser.sequence).step();
+                ++closed;
             }
         }
 
-        return results;
+        transaction.commit();
+        return closed;
     }
 
-    auto CouchbaseLiteDatabase::getDocument (const juce::String& docId) -> juce::var
+    static auto queryInt64 (sqlite3* connection, const char* sql) -> sqlite3_int64
     {
-        juce::var document;
+        Statement statement (connection, sql);
+        return statement.step() ? statement.getInt64 (0) : 0;
+    }
+
+    static auto execute (sqlite3* connection, const juce::String& sql) -> void
+    {
+        Statement::check (connection, sqlite3_exec (connection, sql.toRawUTF8(), nullptr, nullptr, nullptr));
+    }
+
+    // The generation of a revision, the number before the dash of its revid
+    static constexpr char revisionGeneration[] = "CAST(substr(revid, 1, instr(revid, '-') - 1) AS INTEGER)";
+
+    static constexpr auto findPrunedRevisions = joinSql ("INSERT INTO temp.pruned_revs SELECT revs.sequence FROM revs JOIN"
+                                                         " (SELECT doc_id, MAX(", revisionGeneration, ") AS deepest FROM revs"
+                                                         " WHERE doc_id BETWEEN ?1 AND ?2 AND current = 1 GROUP BY doc_id) AS leaves ON leaves.doc_id = revs.doc_id"
+                                                         " WHERE revs.current = 0 AND ", revisionGeneration, " <= leaves.deepest - ?3");
+
+    auto CouchbaseLiteDatabase::compactRevisions (const RevisionCompactionOptions& options) -> RevisionCompactionStats
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        auto connection = db.connection().get();
+
+        RevisionCompactionStats stats;
+        stats.pageSize = queryInt64 (connection, "PRAGMA page_size");
+        stats.pagesBefore = queryInt64 (connection, "PRAGMA page_count");
+
+        execute (connection, "CREATE TEMP TABLE IF NOT EXISTS pruned_revs (sequence INTEGER PRIMARY KEY)");
+
+        Statement clearBodies (connection, "UPDATE revs SET json = NULL WHERE doc_id BETWEEN ?1 AND ?2 AND current = 0 AND json IS NOT NULL");
+        Statement findPruned (connection, findPrunedRevisions.data());
+        Statement detachChildren (connection, "UPDATE revs SET parent = NULL WHERE parent IN (SELECT sequence FROM temp.pruned_revs)");
+        Statement prune (connection, "DELETE FROM revs WHERE sequence IN (SELECT sequence FROM temp.pruned_revs)");
+        Statement clearPruned (connection, "DELETE FROM temp.pruned_revs");
+
+        // Foreign keys are usually off, so ON DELETE doesn't clean up after the pruned revisions
+        std::vector<std::unique_ptr<Statement>> deleteViewRows;
+        {
+            Statement views (connection, "SELECT view_id FROM views");
+            while (views.step())
+                deleteViewRows.push_back (std::make_unique<Statement> (connection, ("DELETE FROM 'maps_" + juce::String (views.getInt64 (0))
+                                                                                    + "' WHERE sequence IN (SELECT sequence FROM temp.pruned_revs)").toStdString()));
+        }
+
+        const auto lastDocument = queryInt64 (connection, "SELECT IFNULL(MAX(doc_id), 0) FROM docs");
+        const auto documentsPerTransaction = static_cast<sqlite3_int64> (juce::jmax (1, options.documentsPerTransaction));
 
-        db << "SELECT doc_id, docid FROM docs WHERE docid = (?)" << docId.toStdString() >> [&] (const int doc_id, const std::string docId)
+        for (sqlite3_int64 first = 1; first <= lastDocument; first += documentsPerTransaction)
         {
-            db << "SELECT doc_id, revid, json, doc_type FROM revs WHERE doc_id = (?) AND current = 1" << doc_id >> [&] (const int doc_id, const std::string revId, const std::string json, const std::string type)
+            const auto last = first + documentsPerTransaction - 1;
+            Transaction transaction (connection);
+
+            clearBodies.reset();
+            clearBodies.bind (1, first).bind (2, last).step();
+            stats.bodiesCleared += sqlite3_changes (connection);
+
+            if (options.maxDepth > 0)
             {
-                document = juce::JSON::parse (json);
-                jassert (document.isObject());
-                if (auto obj = document.getDynamicObject())
+                findPruned.reset();
+                findPruned.bind (1, first).bind (2, last).bind (3, static_cast<sqlite3_int64> (options.maxDepth)).step();
+
+                if (sqlite3_changes (connection) > 0)
                 {
-                    if (!type.empty())
-                        obj->setProperty ("type", juce::String (type));
-                    obj->setProperty ("_rev", juce::String (revId));
-                    obj->setProperty ("_id", juce::String (docId));
+                    detachChildren.reset();
+                    detachChildren.step();
+
+                    for (auto& viewRows : deleteViewRows)
+                    {
+                        viewRows->reset();
+                        viewRows->step();
+                    }
+
+                    prune.reset();
+                    prune.step();
+                    stats.revisionsPruned += sqlite3_changes (connection);
+
+                    clearPruned.reset();
+                    clearPruned.step();
                 }
-            };
-        };
+            }
 
-        return document;
+            transaction.commit();
+            ++stats.transactions;
+        }
+
+        execute (connection, "DROP TABLE IF EXISTS temp.pruned_revs");
+
+        // 0 is NONE, 1 FULL (the pages went back with each commit already) and 2 INCREMENTAL
+        const auto autoVacuum = queryInt64 (connection, "PRAGMA auto_vacuum");
+
+        if (autoVacuum == 1)
+        {
+            stats.vacuumed = true;
+        }
+        else if (autoVacuum == 0 && options.convertToIncrementalVacuum)
+        {
+            execute (connection, "PRAGMA auto_vacuum = INCREMENTAL");
+            execute (connection, "VACUUM");
+            stats.vacuumed = true;
+        }
+        else if (autoVacuum == 2)
+        {
+            stats.vacuumed = true;
+
+            // A few thousand pages at a time, letting go of the write lock in between
+            for (auto freePages = queryInt64 (connection, "PRAGMA freelist_count"); freePages > 0;)
+            {
+                execute (connection, "PRAGMA incremental_vacuum(4096)");
+
+                const auto remaining = queryInt64 (connection, "PRAGMA freelist_count");
+                if (remaining >= freePages)
+                    break;
+
+                freePages = remaining;
+            }
+        }
+
+        stats.pagesAfter = queryInt64 (connection, "PRAGMA page_count");
+        stats.freePagesAfter = queryInt64 (connection, "PRAGMA freelist_count");
+        stats.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return stats;
     }
 
     auto CouchbaseLiteDatabase::getAttachments (const juce::var& doc) -> juce::StringArray
@@ -427,6 +765,12 @@ namespace db {
         return {};
     }
 
+    auto CouchbaseLiteDatabase::openAttachment (const juce::var& doc, const juce::String& attachmentId, MappedAttachment::Access access) -> MappedAttachment
+    {
+        const auto file = getAttachment (doc, attachmentId);
+        return file.existsAsFile() ? MappedAttachment (file, access) : MappedAttachment();
+    }
+
     auto CouchbaseLiteDatabase::getAttachment (const juce::var& doc, const juce::String& attachmentId) -> juce::File
     {
         if (doc.hasProperty ("_attachments") && doc["_attachments"].hasProperty (attachmentId))
@@ -434,31 +778,19 @@ namespace db {
             auto attachmentDoc = doc["_attachments"][juce::Identifier (attachmentId)];
             if (attachmentDoc["stub"])
             {
+                // Attachment files are named after the SHA-1 of their contents
                 auto digest = attachmentDoc["digest"].toString();
-                auto algo = digest.upToFirstOccurrenceOf ("-", false, true);
-                if (algo != "sha1")
+                jassert (digest.startsWith ("sha1-"));
+
+                auto path = attachments.find (digest);
+                if (path != juce::File())
                 {
-                    jassertfalse;
+                    return path;
                 }
-                auto base64 = digest.fromFirstOccurrenceOf ("-", false, true);
-                juce::MemoryOutputStream stream;
-                juce::Base64::convertFromBase64 (stream, base64);
-                juce::MemoryBlock block = stream.getMemoryBlock();
-                auto hexString = juce::String::toHexString (block.getData(), static_cast<int> (block.getSize()), 0);
-
-                auto attDir = dbFile.getSiblingFile ("attachments");
-                if (attDir.isDirectory())
+                else if (attachments.getDirectory().isDirectory())
                 {
-                    auto path = attDir.getChildFile (hexString.toUpperCase() + ".blob");
-                    if (path.existsAsFile())
-                    {
-                        return path;
-                    }
-                    else
-                    {
-                        DBG ("Attachment file not found");
-                        jassertfalse;
-                    }
+                    DBG ("Attachment file not found");
+                    jassertfalse;
                 }
                 else
                 {
@@ -2,12 +2,106 @@
 #pragma once
 #include <JuceHeader.h>
 #include <sqlite_modern_cpp.h>
+#include "StatementCache.h"
+#include "Attachments.h"
+#include "Documents.h"
+#include "Views.h"
+#include <map>
+#include <unordered_set>
 
 namespace db {
 
+    /** Registers the REVID and JSON collations and carray() on a connection. Anything that reads revs or
+        a maps table through its own connection needs them. Returns false if one of them failed. */
+    auto registerExtensions (sqlite3* connection) -> bool;
+
+    /** The db.sqlite3 inside a .cblite2 folder, or the file itself if it isn't a folder. */
+    auto getDatabaseFile (const juce::File& file) -> juce::File;
+
+    /** Replaces blobs that several stores (.cblite2 folders or their db.sqlite3 files) hold a copy of with
+        hard links to a single copy, so each distinct attachment takes up disk space once.
+
+        The copy that is kept is hashed first and must match its digest; a corrupt copy in another store
+        is healed by being replaced. Couchbase Lite never writes to a blob once it is in place, and
+        deleting one link leaves the others intact, so the stores stay independent. Copies on different
+        volumes can't be linked and are left alone.
+    */
+    auto linkDuplicateAttachments (const juce::Array<juce::File>& databases) -> AttachmentCompaction;
+
+    /** Optional changes applied to the database when it is opened. */
+    struct OpenOptions
+    {
+        /** Creates a covering index on revs (doc_type, current, doc_id) so that listing documents by type
+            doesn't have to scan every revision. This adds an index to the file, so it is off by default. */
+        bool createTypeIndex = false;
+
+        /** JSON paths to create field indexes for, see CouchbaseLiteDatabase::createFieldIndex. */
+        juce::StringArray indexedFields;
+    };
+
+    /** A condition on one field of a document, evaluated by SQLite with json_extract so that documents
+        which don't match never leave the database. */
+    struct FieldFilter
+    {
+        enum class Operator
+        {
+            equal,
+            notEqual,
+            less,
+            lessOrEqual,
+            greater,
+            greaterOrEqual
+        };
+
+        /** A JSON path such as "$.created" or "$.state.bps"; a leading "$." may be left out. */
+        juce::String path;
+        Operator op = Operator::equal;
+
+        /** Compared the way SQLite compares values: numbers before text. A void value with equal or
+            notEqual tests whether the field is missing (or null). */
+        juce::var value;
+    };
+
+    /** How compactRevisions slims down the revs table. */
+    struct RevisionCompactionOptions
+    {
+        /** Generations of history kept below each document's deepest leaf, like Couchbase Lite's
+            maxRevTreeDepth. Older non-current revisions are deleted; 0 keeps them all. */
+        int maxDepth = 20;
+
+        /** Documents handled per write transaction, so that other writers (and WAL checkpoints) get a
+            turn in between. */
+        int documentsPerTransaction = 500;
+
+        /** Freed pages are handed back to the file system with PRAGMA incremental_vacuum, which only
+            works if the file has auto_vacuum = INCREMENTAL. Couchbase Lite creates its databases without
+            it, so by default the free pages are left for SQLite to reuse, which
+            RevisionCompactionStats::vacuumed reports. Setting this switches the file over for good with
+            one full VACUUM: that rewrites the whole file, needs as much free disk space again, and fails
+            with SQLITE_BUSY while any statement is open on the connection, e.g. a DocumentView or a
+            ViewCursor still in scope. */
+        bool convertToIncrementalVacuum = false;
+    };
+
+    /** What compactRevisions did. */
+    struct RevisionCompactionStats
+    {
+        juce::int64 bodiesCleared = 0;
+        juce::int64 revisionsPruned = 0;
+        juce::int64 pageSize = 0;
+        juce::int64 pagesBefore = 0;
+        juce::int64 pagesAfter = 0;
+        juce::int64 freePagesAfter = 0;     // still in the file, when it can't be vacuumed incrementally
+        bool vacuumed = false;              // false if the freed pages were left in the file, so none were reclaimed
+        int transactions = 0;
+        double seconds = 0.0;
+
+        auto getBytesReclaimed() const -> juce::int64 { return (pagesBefore - pagesAfter) * pageSize; }
+    };
+
     struct CouchbaseLiteDatabase
     {
-        CouchbaseLiteDatabase (const juce::File& file);
+        CouchbaseLiteDatabase (const juce::File& file, const OpenOptions& options = {});
         auto getAllDocumentIds() -> juce::StringArray;
 
         auto getAllDocumentIds (juce::String type) -> juce::StringArray;
@@ -15,15 +109,173 @@ namespace db {
         auto getDocuments (const juce::StringArray& docIds) -> juce::Array<juce::var>;
         auto getDocument (const juce::String& docId) -> juce::var;
 
+        /** The current revision of a document, read in place without parsing it up front.
+            See DocumentView for how long the row is kept open. */
+        auto getDocumentView (const juce::String& docId) -> DocumentView;
+
+        /** Every revision of a document still in the database, deleted ones and conflicts included,
+            without their bodies. Empty if there is no such document. */
+        auto getRevisionTree (const juce::String& docId) -> RevisionTree;
+
+        /** Every document with conflicting revisions, found with one query over Couchbase Lite's
+            revs_current index. Each document's current revision, as the getters return it, is the
+            winner Couchbase Lite picks: live before deleted, then the highest revid in REVID order (the
+            deepest generation first). */
+        auto findConflicts() -> std::vector<DocumentConflict>;
+
+        /** Resolves conflicts the way Couchbase Lite's own apps do: the winning leaf stays and each
+            losing live leaf gets a deleted child revision, which ends that branch and replicates like any
+            other edit. The leaves are read again inside a single write transaction, so a revision that
+            arrived after findConflicts is taken into account. Returns the number of branches closed.
+
+            A tombstone's revid is the next generation followed by the SHA-1 of its parent's revid, so that
+            closing the same branch twice gives the same revision. That isn't how Couchbase Lite makes its
+            own revids (an MD5 digest of the parent revid, the deleted flag and the body), so if a peer
+            closes the branch too, the two tombstones are siblings rather than one revision. Either still
+            ends the branch. */
+        auto resolveConflicts (const std::vector<DocumentConflict>& conflicts) -> int;
+
+        /** Shrinks the revs table the way Couchbase Lite's compact does: the bodies of revisions that
+            aren't current are cleared, and revisions too far below a document's deepest leaf are deleted
+            (their children become roots, and any view rows left for them go too). This runs in chunks
+            of documents, each in its own transaction, and then gives the freed pages back to the file
+            system. Blobs only the cleared bodies referred to are left for compactAttachments. */
+        auto compactRevisions (const RevisionCompactionOptions& options = {}) -> RevisionCompactionStats;
+
+        /** Streams the current revision of every document of the given type, one at a time, straight off
+            the sqlite step loop, so memory use doesn't grow with the size of the database.
+            Return false from the callback to stop early. Returns the number of documents visited. */
+        auto forEachDocument (const juce::String& type, const std::function<bool (const juce::var&)>& callback) -> int;
+
+        /** Like forEachDocument, but only reads the ids. */
+        auto forEachDocumentId (const juce::String& type, const std::function<bool (const juce::String&)>& callback) -> int;
+
+        /** Like forEachDocument, but hands out the raw row without parsing or copying anything.
+            The row points into sqlite's buffers and is only valid during the callback. */
+        auto forEachRevision (const juce::String& type, const std::function<bool (const RevisionRow&)>& callback) -> int;
+
+        /** Decodes every current Riff or Loop straight from its json blob into a typed struct, skipping
+            the var tree. The same struct is reused for every row, so copy out what you want to keep. */
+        auto forEachRiff (const std::function<bool (const Riff&)>& callback) -> int;
+        auto forEachLoop (const std::function<bool (const Loop&)>& callback) -> int;
+
+        /** Reads only the given fields of the current documents of a type that pass all the filters, with
+            both the projection and the filtering done by SQLite. The callback gets the document id and one
+            value per path, void where the document doesn't have it. Return false from it to stop early.
+            Returns the number of documents visited. */
+        auto selectFields (const juce::String& type,
+                           const juce::StringArray& paths,
+                           const juce::Array<FieldFilter>& filters,
+                           const std::function<bool (const juce::String& docId, const juce::Array<juce::var>& values)>& callback) -> int;
+
+        /** Creates an expression index on (doc_type, field) over current revisions, which selectFields uses
+            for filters on that path. Like the type index this changes the file, and whatever opens it
+            afterwards needs an SQLite with the JSON functions built in. */
+        auto createFieldIndex (const juce::String& path) -> void;
+
         auto getLocalDocument (const juce::String& docId) -> juce::var;
         auto setLocalDocument (juce::var doc) -> int;
 
         auto getAttachments (const juce::var& doc) -> juce::StringArray;
         auto getAttachment (const juce::var& doc, const juce::String& attachmentId) -> juce::File;
         auto getAttachmentMime (const juce::var& doc, const juce::String& attachmentId) -> juce::String;
+
+        /** Maps an attachment's file into memory to read it without copying; the result isn't valid if
+            getAttachment can't find the file. */
+        auto openAttachment (const juce::var& doc, const juce::String& attachmentId,
+                             MappedAttachment::Access access = MappedAttachment::Access::sequential) -> MappedAttachment;
+
+        /** Checks the attachments folder against the documents: every blob a stored revision body refers
+            to is mapped and hashed on numThreads threads (0 for one per CPU), largest first, and compared
+            with its digest. Blobs nothing refers to are listed as orphaned but not hashed. */
+        auto verifyAttachments (int numThreads = 0) -> AttachmentReport;
+
+        /** Deletes the blobs no stored revision body refers to, or moves them into archiveFolder if one
+            is given. Old revisions keep their blobs until compactRevisions clears their bodies. Blobs
+            modified less than minimumAge ago are left alone, as a replicator may have written one whose
+            revision isn't in yet. */
+        auto compactAttachments (const juce::File& archiveFolder = {},
+                                 juce::RelativeTime minimumAge = juce::RelativeTime::hours (1)) -> AttachmentCompaction;
+
+        /** Registers a native map function for the named view. The view gets a row in the views table
+            and a maps_N table like Couchbase Lite's own views, so pick a name the app doesn't use.
+            If the version differs from the one stored, the view's rows are thrown away and rebuilt by
+            the next updateView. */
+        auto registerView (const juce::String& name, const juce::String& version, MapFunction map) -> void;
+
+        /** Brings a registered view up to date: only documents with revisions newer than the view's
+            lastsequence are mapped again, in a single transaction. */
+        auto updateView (const juce::String& name) -> ViewUpdateStats;
+
+        /** Throws a view's rows away and maps every live document again. Ranges of sequences are handed
+            out to numThreads workers (0 for one per CPU), each reading through its own connection, and
+            what they emit is written through this connection in large transactions.
+            The map function is called from several threads at once, so it must be thread safe.
+            This needs a database in WAL mode, so the readers don't block the writer's commits. Otherwise
+            the view is rebuilt on this thread with updateView. */
+        auto rebuildView (const juce::String& name, int numThreads = 0) -> ViewUpdateStats;
+
+        /** Queries a view, either one registered here or one Couchbase Lite built into the file. Rows come
+            back in key order as a range scan on the key index (rows with equal keys in the order they were
+            emitted), or in the order of options.keys. A registered view is brought up to date first unless
+            options.stale is set. Returns an empty cursor if there is no view with that name. */
+        auto queryView (const juce::String& name, const ViewQueryOptions& options = {}) -> ViewCursor;
+
+        /** Runs an FTS5 query (e.g. "night jam*" or "\"late night\" OR drums") against the text a view
+            emitted with ViewEmitter::emitText, returning the IDs of the matching documents best first, as
+            ranked by bm25. A registered view is brought up to date first. Throws std::runtime_error if
+            sqlite was built without FTS5; see hasFullTextSearch. */
+        auto searchText (const juce::String& viewName, const juce::String& query, int limit = 50) -> juce::StringArray;
+
+        /** Rows a view emitted with ViewEmitter::emitBoundingBox whose box overlaps the area (edges included),
+            found through the view's R*Tree rather than a scan. A registered view is brought up to date first.
+            Throws std::runtime_error if sqlite was built without R*Tree; see hasSpatialIndex. */
+        auto queryBoundingBox (const juce::String& viewName, juce::Rectangle<double> area, int limit = -1) -> std::vector<SpatialRow>;
+
+        /** Whether the sqlite this runs on has FTS5, without which searchText and views that emit text
+            throw. The Mac build uses the system's sqlite, which isn't guaranteed to have it. */
+        auto hasFullTextSearch() -> bool { return hasFullTextModule (db.connection().get()); }
+
+        /** The same for the R*Tree module behind queryBoundingBox and ViewEmitter::emitBoundingBox. */
+        auto hasSpatialIndex() -> bool { return hasRTreeModule (db.connection().get()); }
+
+        /** Hits, misses and time spent preparing for the statements cached by this database. */
+        auto getStatementCacheStats() const -> StatementCache::Stats { return statements.getStats(); }
     private:
+        struct RegisteredView
+        {
+            int viewId = 0;
+            MapFunction map;
+        };
+
+        auto getRegisteredView (const juce::String& name) const -> const RegisteredView*;
+
+        /** Digests of the attachments that any revision with a stored body refers to: current ones,
+            conflicts, and older revisions compactRevisions hasn't cleared yet. */
+        auto getReferencedAttachments() -> std::unordered_set<std::string>;
+
+        /** Bounds of a view query as JSON text, low to high whichever way the rows are read. */
+        struct KeyRange
+        {
+            std::optional<std::string> low, high;
+            bool lowInclusive = true;
+            bool highInclusive = true;
+            bool descending = false;
+        };
+
+        /** view_id of a registered or Couchbase Lite view, or 0 if there is none by that name. */
+        auto findView (const juce::String& name, bool bringUpToDate) -> int;
+
+        static auto getKeyRange (const ViewQueryOptions& options) -> KeyRange;
+        auto openViewQuery (int viewId, const ViewQueryOptions& options, const KeyRange& range) -> ViewCursor;
+        auto buildReduceCache (int viewId, int level) -> void;
+        auto queryReduceCache (int viewId, const ViewQueryOptions& options) -> ViewCursor;
+
         juce::File dbFile;
         sqlite::database db;
+        StatementCache statements { db };
+        AttachmentIndex attachments { dbFile.getSiblingFile ("attachments") };
+        std::map<juce::String, RegisteredView> views;
         JUCE_LEAK_DETECTOR (CouchbaseLiteDatabase)
     };
 }
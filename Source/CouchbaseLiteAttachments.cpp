@@ -0,0 +1,250 @@
+#include "CouchbaseLite.h"
+#include "Sha1.h"
+#include "SqliteStatement.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace db {
+
+    /** From the UTF-8 name, which std::filesystem passes through as it is on POSIX instead of going
+        through the locale's wide character conversion. */
+    static auto toPath (const juce::File& file) -> std::filesystem::path
+    {
+        return std::filesystem::path (std::u8string (reinterpret_cast<const char8_t*> (file.getFullPathName().toRawUTF8())));
+    }
+
+    /** The space deleting a file gives back: none if another hard link keeps its data around. */
+    static auto getReclaimableSize (const juce::File& file) -> juce::int64
+    {
+        std::error_code error;
+        const auto links = std::filesystem::hard_link_count (toPath (file), error);
+        return ! error && links == 1 ? file.getSize() : 0;
+    }
+
+    static auto isIntact (const juce::File& blob, const std::string& digest) -> bool
+    {
+        const MappedAttachment mapped (blob, MappedAttachment::Access::sequential);
+        return getAttachmentDigest (computeSha1 (mapped.getBytes())) == digest;
+    }
+
+    auto linkDuplicateAttachments (const juce::Array<juce::File>& databases) -> AttachmentCompaction
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+
+        // Every copy of each digest, in the order the stores were given
+        std::unordered_map<std::string, std::vector<juce::File>> copies;
+        for (auto& database : databases)
+        {
+            AttachmentIndex index (getDatabaseFile (database).getSiblingFile ("attachments"));
+            for (auto& [digest, blob] : index.getBlobs())
+                copies[digest].push_back (blob);
+        }
+
+        AttachmentCompaction compaction;
+
+        for (auto& [digest, blobs] : copies)
+        {
+            std::error_code error;
+            const auto isLinked = [&] (const juce::File& a, const juce::File& b) { return std::filesystem::equivalent (toPath (a), toPath (b), error); };
+
+            if (std::all_of (blobs.begin() + 1, blobs.end(), [&] (const juce::File& blob) { return isLinked (blobs.front(), blob); }))
+                continue;
+
+            const auto kept = std::find_if (blobs.begin(), blobs.end(), [&] (const juce::File& blob) { return isIntact (blob, digest); });
+            if (kept == blobs.end())
+            {
+                jassertfalse; // every copy is corrupt
+                continue;
+            }
+
+            const auto keptPath = toPath (*kept);
+
+            for (auto& blob : blobs)
+            {
+                if (blob == *kept || isLinked (*kept, blob))
+                    continue;
+
+                // The link is made under another name and renamed over the copy, so the blob never goes missing
+                const auto path = toPath (blob);
+                auto temporary = path;
+                temporary += ".link";
+
+                const auto reclaimable = getReclaimableSize (blob);
+                std::filesystem::remove (temporary, error);
+
+                std::filesystem::create_hard_link (keptPath, temporary, error);
+                if (error)
+                    continue;   // e.g. on another volume
+
+                std::filesystem::rename (temporary, path, error);
+                if (error)
+                {
+                    std::filesystem::remove (temporary, error);
+                    continue;
+                }
+
+                ++compaction.linked;
+                compaction.bytesReclaimed += reclaimable;
+            }
+        }
+
+        compaction.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return compaction;
+    }
+
+    auto CouchbaseLiteDatabase::getReferencedAttachments() -> std::unordered_set<std::string>
+    {
+        // Not just the current revisions: getAttachment works on any revision whose body is still stored
+        Statement revisions (db.connection().get(), "SELECT json FROM revs WHERE json IS NOT NULL AND length(json) > 0");
+
+        std::unordered_set<std::string> digests;
+        std::vector<AttachmentInfo> revisionAttachments;
+
+        while (revisions.step())
+        {
+            if (! decodeAttachments (revisions.getText (0), revisionAttachments))
+                jassertfalse;
+
+            for (auto& attachment : revisionAttachments)
+                if (! attachment.digest.empty())
+                    digests.insert (attachment.digest);
+        }
+
+        return digests;
+    }
+
+    auto CouchbaseLiteDatabase::verifyAttachments (int numThreads) -> AttachmentReport
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+
+        AttachmentReport report;
+        report.threads = numThreads > 0 ? numThreads : juce::jmax (1, juce::SystemStats::getNumCpus());
+
+        const auto referenced = getReferencedAttachments();
+        report.referenced = static_cast<int> (referenced.size());
+
+        struct Blob
+        {
+            std::string digest;
+            juce::File file;
+            juce::int64 size = 0;
+        };
+
+        std::vector<Blob> blobs;
+        std::unordered_set<std::string_view> found;
+
+        for (auto& [digest, file] : attachments.getBlobs())
+        {
+            if (referenced.contains (digest))
+                blobs.push_back ({ std::move (digest), file, file.getSize() });
+            else
+                report.orphaned.push_back (file);
+        }
+
+        for (auto& blob : blobs)
+            found.insert (blob.digest);
+
+        for (auto& digest : referenced)
+            if (! found.contains (digest))
+                report.missing.push_back (digest);
+
+        // The biggest blobs go first, so no thread is left hashing a long one after the rest are done
+        std::sort (blobs.begin(), blobs.end(), [] (const Blob& a, const Blob& b) { return a.size > b.size; });
+
+        std::atomic<size_t> nextBlob { 0 };
+        std::atomic<juce::int64> bytesHashed { 0 };
+        std::atomic<int> verified { 0 };
+        std::mutex corruptLock;
+
+        const auto hashBlobs = [&]
+        {
+            for (auto index = nextBlob++; index < blobs.size(); index = nextBlob++)
+            {
+                const auto& blob = blobs[index];
+
+                // An empty blob doesn't map, which hashes just like the empty file it is
+                const MappedAttachment mapped (blob.file, MappedAttachment::Access::sequential);
+                const auto digest = getAttachmentDigest (computeSha1 (mapped.getBytes()));
+                bytesHashed += static_cast<juce::int64> (mapped.getSize());
+
+                if (digest == blob.digest)
+                {
+                    ++verified;
+                }
+                else
+                {
+                    const std::lock_guard scoped (corruptLock);
+                    report.corrupt.push_back (blob.file);
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < juce::jmin (report.threads, static_cast<int> (blobs.size())); ++i)
+            workers.emplace_back (hashBlobs);
+
+        hashBlobs();
+
+        for (auto& worker : workers)
+            worker.join();
+
+        std::sort (report.missing.begin(), report.missing.end());
+        std::sort (report.corrupt.begin(), report.corrupt.end());
+        std::sort (report.orphaned.begin(), report.orphaned.end());
+
+        report.verified = verified;
+        report.bytesHashed = bytesHashed;
+        report.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return report;
+    }
+
+    auto CouchbaseLiteDatabase::compactAttachments (const juce::File& archiveFolder, juce::RelativeTime minimumAge) -> AttachmentCompaction
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        const auto archive = archiveFolder != juce::File();
+        AttachmentCompaction compaction;
+
+        if (archive && ! archiveFolder.createDirectory().wasOk())
+        {
+            jassertfalse;
+            return compaction;
+        }
+
+        const auto referenced = getReferencedAttachments();
+        const auto newest = juce::Time::getCurrentTime() - minimumAge;
+
+        for (auto& [digest, blob] : attachments.getBlobs())
+        {
+            if (referenced.contains (digest) || blob.getLastModificationTime() > newest)
+                continue;
+
+            if (archive)
+            {
+                const auto size = blob.getSize();
+                if (! blob.moveFileTo (archiveFolder.getChildFile (blob.getFileName())))
+                    continue;
+
+                compaction.bytesArchived += size;
+            }
+            else
+            {
+                const auto reclaimable = getReclaimableSize (blob);
+                if (! blob.deleteFile())
+                    continue;
+
+                compaction.bytesReclaimed += reclaimable;
+            }
+
+            compaction.removed.push_back (blob);
+        }
+
+        std::sort (compaction.removed.begin(), compaction.removed.end());
+        compaction.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return compaction;
+    }
+}
@@ -0,0 +1,1346 @@
+#include "CouchbaseLite.h"
+#include "Collation.h"
+#include "JsonReader.h"
+#include "SqliteStatement.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace db {
+
+    void ViewEmitter::emit (const juce::var& key, const juce::var& value)
+    {
+        rows.push_back ({ juce::JSON::toString (key, true),
+                          value.isVoid() ? juce::String() : juce::JSON::toString (value, true),
+                          {},
+                          {} });
+    }
+
+    void ViewEmitter::emitText (const juce::String& text, const juce::var& value)
+    {
+        rows.push_back ({ "null", value.isVoid() ? juce::String() : juce::JSON::toString (value, true), text, {} });
+    }
+
+    void ViewEmitter::emitBoundingBox (juce::Rectangle<double> bounds, const juce::var& value)
+    {
+        rows.push_back ({ "null", value.isVoid() ? juce::String() : juce::JSON::toString (value, true), {}, bounds });
+    }
+
+    static auto getMapsTable (int viewId) -> juce::String
+    {
+        return "maps_" + juce::String (viewId);
+    }
+
+    static auto execute (sqlite3* connection, const juce::String& sql) -> void
+    {
+        Statement::check (connection, sqlite3_exec (connection, sql.toRawUTF8(), nullptr, nullptr, nullptr));
+    }
+
+    /** One row per group for each group level that has been queried with ViewQueryOptions::cached; level -1
+        holds the groups of whole keys. */
+    static auto getReduceTable (int viewId) -> juce::String
+    {
+        return "reduce_" + juce::String (viewId);
+    }
+
+    /** The maps table with the same indexes Couchbase Lite puts on its own, and our reduce cache. */
+    static auto createViewTable (sqlite3* connection, int viewId) -> void
+    {
+        const auto table = getMapsTable (viewId);
+        execute (connection, getViewTableCreate (viewId));
+        execute (connection, "CREATE INDEX IF NOT EXISTS '" + table + "_keys' ON '" + table + "' (key COLLATE JSON)");
+        execute (connection, "CREATE INDEX IF NOT EXISTS '" + table + "_sequence' ON '" + table + "' (sequence)");
+        execute (connection, "CREATE TABLE IF NOT EXISTS '" + getReduceTable (viewId) + "' (level INTEGER NOT NULL, key TEXT NOT NULL COLLATE JSON,"
+                             " count INTEGER NOT NULL, sum REAL NOT NULL, sumsqr REAL NOT NULL, min REAL, max REAL, stale BOOLEAN NOT NULL DEFAULT 0,"
+                             " PRIMARY KEY (level, key)) WITHOUT ROWID");
+    }
+
+    namespace {
+
+        struct MappedRow
+        {
+            sqlite3_int64 sequence;
+            std::string key;
+            std::string value;      // empty for a null value
+            std::string text;
+            std::optional<juce::Rectangle<double>> bounds;
+        };
+
+        using RowBatch = std::vector<MappedRow>;
+
+        /** Carries batches of rows from the rebuild workers to the writer. push() blocks while the queue is
+            full, so the mappers can't run more than a few batches ahead of the writer. */
+        class RowQueue
+        {
+        public:
+            RowQueue (size_t maxBatches, int numProducers) : capacity (maxBatches), producers (numProducers)
+            {
+            }
+
+            /** Returns false if the queue was cancelled while waiting for room. */
+            auto push (RowBatch&& batch) -> bool
+            {
+                std::unique_lock lock (mutex);
+                notFull.wait (lock, [this] { return cancelled || batches.size() < capacity; });
+
+                if (cancelled)
+                    return false;
+
+                batches.push_back (std::move (batch));
+                notEmpty.notify_one();
+                return true;
+            }
+
+            /** Returns false once every producer has finished and the queue is drained, or it was cancelled. */
+            auto pop (RowBatch& batch) -> bool
+            {
+                std::unique_lock lock (mutex);
+                notEmpty.wait (lock, [this] { return cancelled || ! batches.empty() || producers == 0; });
+
+                if (cancelled || batches.empty())
+                    return false;
+
+                batch = std::move (batches.front());
+                batches.pop_front();
+                notFull.notify_one();
+                return true;
+            }
+
+            void producerFinished()
+            {
+                std::lock_guard lock (mutex);
+                --producers;
+                notEmpty.notify_all();
+            }
+
+            void cancel()
+            {
+                std::lock_guard lock (mutex);
+                cancelled = true;
+                notFull.notify_all();
+                notEmpty.notify_all();
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable notFull, notEmpty;
+            std::deque<RowBatch> batches;
+            const size_t capacity;
+            int producers;
+            bool cancelled = false;
+        };
+
+        using Connection = std::unique_ptr<sqlite3, decltype (&sqlite3_close)>;
+
+        auto openReadConnection (const juce::File& file) -> Connection
+        {
+            sqlite3* opened = nullptr;
+            const int result = sqlite3_open_v2 (file.getFullPathName().toRawUTF8(), &opened, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr);
+            Connection connection (opened, &sqlite3_close);
+            Statement::check (opened, result);
+
+            if (! registerExtensions (opened))
+                throw std::runtime_error ("SQLite error: couldn't register collations on a read connection");
+
+            return connection;
+        }
+    }
+
+    /** The key of the group a row belongs to: the whole key at level -1, null at level 0, and otherwise
+        the first level elements of an array key. Keys that aren't arrays are a group of their own. */
+    static auto getGroupKey (std::string_view key, int level) -> std::string
+    {
+        if (level < 0)
+            return std::string (key);
+
+        if (level == 0)
+            return "null";
+
+        JsonReader reader (key);
+        if (reader.peek() != JsonReader::Type::array || ! reader.enterArray())
+            return std::string (key);
+
+        std::string prefix = "[";
+        std::string_view element;
+
+        for (int i = 0; i < level && reader.nextElement() && reader.readRaw (element); ++i)
+        {
+            if (i > 0)
+                prefix += ',';
+
+            prefix += element;
+        }
+
+        return prefix + "]";
+    }
+
+    static auto getGroupLevel (const ViewQueryOptions& options) -> int
+    {
+        return options.group ? -1 : juce::jmax (0, options.groupLevel);
+    }
+
+    /** Reads a row's value as a number, if it is one. */
+    static auto getNumber (std::string_view value, double& number) -> bool
+    {
+        JsonReader reader (value);
+        return reader.peek() == JsonReader::Type::number && reader.read (number);
+    }
+
+    static auto makeReducedValue (ViewQueryOptions::Reducer reduce, const ReduceTotals& totals) -> juce::var
+    {
+        if (reduce == ViewQueryOptions::Reducer::count)
+            return totals.count;
+
+        if (reduce == ViewQueryOptions::Reducer::sum)
+            return totals.sum;
+
+        auto stats = new juce::DynamicObject();
+        stats->setProperty ("sum", totals.sum);
+        stats->setProperty ("count", totals.count);
+        stats->setProperty ("min", totals.hasNumbers ? totals.min : 0.0);
+        stats->setProperty ("max", totals.hasNumbers ? totals.max : 0.0);
+        stats->setProperty ("sumsqr", totals.sumOfSquares);
+        return stats;
+    }
+
+    /** Binds a reduce cache row as ?1 level, ?2 key, then ?3 to ?7 count, sum, sumsqr, min and max. */
+    static auto bindTotals (Statement& statement, int level, std::string_view key, const ReduceTotals& totals) -> void
+    {
+        statement.bind (1, static_cast<sqlite3_int64> (level))
+                 .bind (2, key)
+                 .bind (3, static_cast<sqlite3_int64> (totals.count))
+                 .bind (4, totals.sum)
+                 .bind (5, totals.sumOfSquares);
+
+        if (totals.hasNumbers)
+            statement.bind (6, totals.min).bind (7, totals.max);
+        else
+            statement.bindNull (6).bindNull (7);
+    }
+
+    namespace {
+
+        /** Applies the rows updateView removes from and adds to a view to every group level its reduce cache
+            holds. Count, sum and sumsqr are adjusted in place; removing a value at a group's min or max marks
+            the group stale, and it is reduced from its rows again the next time it is read. */
+        class ReduceCacheUpdater
+        {
+        public:
+            ReduceCacheUpdater (sqlite3* connection, int viewId)
+            {
+                const auto table = getReduceTable (viewId).toStdString();
+
+                Statement cachedLevels (connection, "SELECT DISTINCT level FROM '" + table + "'");
+                while (cachedLevels.step())
+                    levels.push_back (static_cast<int> (cachedLevels.getInt64 (0)));
+
+                if (levels.empty())
+                    return;
+
+                removeRow = std::make_unique<Statement> (connection, "UPDATE '" + table + "' SET count = count - 1, sum = sum - ?3, sumsqr = sumsqr - ?3 * ?3,"
+                                                                     " stale = stale OR (?4 AND (min IS NULL OR ?3 <= min OR ?3 >= max))"
+                                                                     " WHERE level = ?1 AND key = ?2");
+                dropEmpty = std::make_unique<Statement> (connection, "DELETE FROM '" + table + "' WHERE count <= 0");
+                addRow = std::make_unique<Statement> (connection, "INSERT INTO '" + table + "' (level, key, count, sum, sumsqr, min, max) VALUES (?1, ?2, 1, ?3, ?3 * ?3, ?4, ?4)"
+                                                                  " ON CONFLICT (level, key) DO UPDATE SET count = count + 1, sum = sum + excluded.sum, sumsqr = sumsqr + excluded.sumsqr,"
+                                                                  " min = CASE WHEN excluded.min IS NOT NULL AND (min IS NULL OR excluded.min < min) THEN excluded.min ELSE min END,"
+                                                                  " max = CASE WHEN excluded.max IS NOT NULL AND (max IS NULL OR excluded.max > max) THEN excluded.max ELSE max END");
+            }
+
+            auto isActive() const -> bool { return ! levels.empty(); }
+
+            void remove (std::string_view key, std::string_view value)
+            {
+                double number = 0.0;
+                const bool isNumber = getNumber (value, number);
+
+                for (const auto level : levels)
+                {
+                    removeRow->bind (1, static_cast<sqlite3_int64> (level)).bind (2, getGroupKey (key, level))
+                              .bind (3, isNumber ? number : 0.0).bind (4, static_cast<sqlite3_int64> (isNumber));
+                    removeRow->step();
+                    removeRow->reset();
+                }
+            }
+
+            /** Call after the last remove() and before the first add(), so a group that empties and fills up
+                again in one update starts afresh. */
+            void dropEmptyGroups()
+            {
+                dropEmpty->step();
+                dropEmpty->reset();
+            }
+
+            void add (std::string_view key, std::string_view value)
+            {
+                double number = 0.0;
+                const bool isNumber = getNumber (value, number);
+
+                for (const auto level : levels)
+                {
+                    addRow->bind (1, static_cast<sqlite3_int64> (level)).bind (2, getGroupKey (key, level)).bind (3, isNumber ? number : 0.0);
+
+                    if (isNumber)
+                        addRow->bind (4, number);
+                    else
+                        addRow->bindNull (4);
+
+                    addRow->step();
+                    addRow->reset();
+                }
+            }
+
+        private:
+            std::vector<int> levels;
+            std::unique_ptr<Statement> removeRow, dropEmpty, addRow;
+        };
+    }
+
+    ViewCursor::ViewCursor (std::unique_ptr<Statement> rangeOrKeyStatement, const ViewQueryOptions& options)
+        : statement (std::move (rangeOrKeyStatement)), reduce (options.reduce), groupLevel (getGroupLevel (options))
+    {
+        for (auto& k : options.keys)
+            keys.push_back (juce::JSON::toString (k, true).toStdString());
+
+        if (! keys.empty())
+            statement->bind (1, keys[nextKey++]);
+
+        // A plain range query has its skip and limit applied by sqlite
+        if (! keys.empty() || reduce != ViewQueryOptions::Reducer::none)
+        {
+            toSkip = options.skip;
+            remaining = options.limit;
+        }
+    }
+
+    ViewCursor::ViewCursor (ReducedRows rows, const ViewQueryOptions& options)
+        : reduce (options.reduce), groupLevel (getGroupLevel (options)), toSkip (options.skip), remaining (options.limit), cachedRows (std::move (rows))
+    {
+    }
+
+    auto ViewCursor::next() -> bool
+    {
+        if (statement == nullptr && cachedRows.empty())
+            return false;
+
+        while (remaining != 0)
+        {
+            const bool found = statement == nullptr ? nextCachedRow()
+                             : reduce == ViewQueryOptions::Reducer::none ? stepRow()
+                             : nextReduced();
+            if (! found)
+                return false;
+
+            if (toSkip > 0)
+            {
+                --toSkip;
+                continue;
+            }
+
+            if (remaining > 0)
+                --remaining;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    auto ViewCursor::stepRow() -> bool
+    {
+        // sqlite starts a statement over if it is stepped again after it is done
+        while (! sourceDone)
+        {
+            if (statement->step())
+            {
+                readRow();
+                return true;
+            }
+
+            if (nextKey >= keys.size())
+            {
+                sourceDone = true;
+            }
+            else
+            {
+                statement->reset();
+                statement->bind (1, keys[nextKey++]);
+            }
+        }
+
+        return false;
+    }
+
+    auto ViewCursor::readRow() -> void
+    {
+        key = statement->getText (0);
+        value = statement->getText (1);
+        docId = statement->getText (2);
+    }
+
+    auto ViewCursor::nextCachedRow() -> bool
+    {
+        if (cachedRow >= cachedRows.size())
+            return false;
+
+        const auto& row = cachedRows[cachedRow++];
+        key = row.first;
+        reducedValue = row.second;
+        value = {};
+        docId = {};
+        return true;
+    }
+
+    auto ViewCursor::isInGroup (std::string_view rowKey) const -> bool
+    {
+        if (groupLevel < 0)
+            return collateJSON (rowKey, groupKey) == 0;
+
+        if (groupLevel == 0)
+            return true;
+
+        JsonReader row (rowKey), current (groupKey);
+        if (row.peek() != JsonReader::Type::array || current.peek() != JsonReader::Type::array)
+            return collateJSON (rowKey, groupKey) == 0;
+
+        row.enterArray();
+        current.enterArray();
+
+        for (int i = 0; i < groupLevel; ++i)
+        {
+            const bool rowHasMore = row.nextElement();
+            if (rowHasMore != current.nextElement())
+                return false;
+
+            if (! rowHasMore)
+                break;
+
+            std::string_view element1, element2;
+            if (! row.readRaw (element1) || ! current.readRaw (element2) || collateJSON (element1, element2) != 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    auto ViewCursor::nextReduced() -> bool
+    {
+        if (rowPending)
+            readRow();
+        else if (! stepRow())
+            return false;
+
+        totals = {};
+
+        const auto add = [&]
+        {
+            ++totals.count;
+
+            double number;
+            if (reduce == ViewQueryOptions::Reducer::count || ! getNumber (value, number))
+                return;
+
+            totals.sum += number;
+            totals.sumOfSquares += number * number;
+            totals.min = totals.hasNumbers ? juce::jmin (totals.min, number) : number;
+            totals.max = totals.hasNumbers ? juce::jmax (totals.max, number) : number;
+            totals.hasNumbers = true;
+        };
+
+        groupKey = getGroupKey (key, groupLevel);
+        add();
+        rowPending = false;
+
+        while (stepRow())
+        {
+            if (! isInGroup (key))
+            {
+                rowPending = true;
+                break;
+            }
+
+            add();
+        }
+
+        reducedValue = makeReducedValue (reduce, totals);
+        key = groupKey;
+        value = {};
+        docId = {};
+        return true;
+    }
+
+    auto ViewCursor::getKey() const -> juce::var
+    {
+        return juce::JSON::parse (toString (key));
+    }
+
+    auto ViewCursor::getValue() const -> juce::var
+    {
+        return reduce != ViewQueryOptions::Reducer::none ? reducedValue : juce::JSON::parse (toString (value));
+    }
+
+    auto ViewCursor::getDocId() const -> juce::String
+    {
+        return toString (docId);
+    }
+
+    static auto getFullTextTable (int viewId) -> juce::String
+    {
+        return "fulltext_" + juce::String (viewId);
+    }
+
+    static auto getBoundingBoxTable (int viewId) -> juce::String
+    {
+        return "bboxes_" + juce::String (viewId);
+    }
+
+    static auto tableExists (sqlite3* connection, std::string_view name) -> bool
+    {
+        Statement exists (connection, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?1");
+        exists.bind (1, name);
+        return exists.step();
+    }
+
+    /** True if the statement compiles, i.e. every function it calls exists on this connection. */
+    static auto canPrepare (sqlite3* connection, const char* sql) -> bool
+    {
+        sqlite3_stmt* probe = nullptr;
+        const auto result = sqlite3_prepare_v2 (connection, sql, -1, &probe, nullptr);
+        sqlite3_finalize (probe);
+        return result == SQLITE_OK;
+    }
+
+    auto hasFullTextModule (sqlite3* connection) -> bool
+    {
+        // FTS5 registers this function along with the module
+        return canPrepare (connection, "SELECT fts5_source_id()");
+    }
+
+    auto hasRTreeModule (sqlite3* connection) -> bool
+    {
+        // as does the R*Tree module; it only complains about the NULL when stepped
+        return canPrepare (connection, "SELECT rtreedepth(NULL)");
+    }
+
+    /** Deletes a view's full-text rows along with the maps rows they belong to. It's a TEMP trigger, so it
+        goes away with the connection and the file keeps nothing that needs FTS5: an sqlite without it,
+        Couchbase Lite's included, can still delete from maps_N. */
+    static auto createFullTextTrigger (sqlite3* connection, int viewId) -> void
+    {
+        const auto maps = getMapsTable (viewId);
+        execute (connection, "CREATE TEMP TRIGGER IF NOT EXISTS '" + maps + "_fulltext_delete' AFTER DELETE ON main.'" + maps + "'"
+                             " WHEN old.fulltext_id IS NOT NULL BEGIN DELETE FROM main.'" + getFullTextTable (viewId) + "' WHERE rowid = old.fulltext_id; END");
+    }
+
+    /** The same for a view's R*Tree boxes, which would otherwise need the rtree module. */
+    static auto createBoundingBoxTrigger (sqlite3* connection, int viewId) -> void
+    {
+        const auto maps = getMapsTable (viewId);
+        execute (connection, "CREATE TEMP TRIGGER IF NOT EXISTS '" + maps + "_bbox_delete' AFTER DELETE ON main.'" + maps + "'"
+                             " WHEN old.bbox_id IS NOT NULL BEGIN DELETE FROM main.'" + getBoundingBoxTable (viewId) + "' WHERE id = old.bbox_id; END");
+    }
+
+    auto createViewTriggers (sqlite3* connection, int viewId) -> void
+    {
+        const auto maps = getMapsTable (viewId);
+        const auto fullText = getFullTextTable (viewId);
+        const auto boxes = getBoundingBoxTable (viewId);
+
+        // Earlier builds created these as permanent triggers. Whatever deleted maps rows while no trigger
+        // was there left their text and boxes behind. Without the module the table can't be touched at
+        // all, so its orphans are left for a build that has it to sweep.
+        if (tableExists (connection, fullText.toStdString()))
+        {
+            execute (connection, "DROP TRIGGER IF EXISTS main.'" + maps + "_fulltext_delete'");
+
+            if (hasFullTextModule (connection))
+            {
+                execute (connection, "DELETE FROM '" + fullText + "' WHERE rowid NOT IN (SELECT fulltext_id FROM '" + maps + "' WHERE fulltext_id IS NOT NULL)");
+                createFullTextTrigger (connection, viewId);
+            }
+        }
+
+        if (tableExists (connection, boxes.toStdString()))
+        {
+            execute (connection, "DROP TRIGGER IF EXISTS main.'" + maps + "_bbox_delete'");
+
+            if (hasRTreeModule (connection))
+            {
+                execute (connection, "DELETE FROM '" + boxes + "' WHERE id NOT IN (SELECT bbox_id FROM '" + maps + "' WHERE bbox_id IS NOT NULL)");
+                createBoundingBoxTrigger (connection, viewId);
+            }
+        }
+    }
+
+    namespace {
+
+        /** Inserts rows into a view's maps table. The text of full-text rows goes into the view's FTS5
+            table and the boxes of spatial rows into its R*Tree, each only created when the view emits the
+            first row that needs it, so views without them work with an sqlite built without either. */
+        class MapsWriter
+        {
+        public:
+            MapsWriter (sqlite3* db, int id)
+                : connection (db), viewId (id),
+                  insert (db, "INSERT INTO '" + getMapsTable (id).toStdString() + "' (sequence, key, value, fulltext_id, bbox_id, geokey)"
+                                 " VALUES (?1, ?2, ?3, ?4, ?5, ?6)")
+            {
+            }
+
+            void add (sqlite3_int64 sequence, std::string_view key, std::string_view value, std::string_view text,
+                      const std::optional<juce::Rectangle<double>>& bounds)
+            {
+                insert.bind (1, sequence).bind (2, key);
+
+                if (value.empty())
+                    insert.bindNull (3);
+                else
+                    insert.bind (3, value);
+
+                if (text.empty())
+                    insert.bindNull (4);
+                else
+                    insert.bind (4, addText (text));
+
+                if (bounds.has_value())
+                {
+                    // geokey keeps the exact box: the R*Tree stores it as 32-bit floats, rounded outwards
+                    const std::array<double, 4> exact { bounds->getX(), bounds->getRight(), bounds->getY(), bounds->getBottom() };
+                    insert.bind (5, addBounds (exact)).bindBlob (6, exact.data(), static_cast<int> (sizeof (exact)));
+                }
+                else
+                {
+                    insert.bindNull (5).bindNull (6);
+                }
+
+                insert.step();
+                insert.reset();
+            }
+
+        private:
+            auto addText (std::string_view text) -> sqlite3_int64
+            {
+                if (insertText == nullptr)
+                {
+                    if (! hasFullTextModule (connection))
+                        throw std::runtime_error ("SQLite error: emitText needs FTS5, which this build of sqlite doesn't have");
+
+                    const auto maps = getMapsTable (viewId);
+                    const auto fullText = getFullTextTable (viewId);
+
+                    // The trigger takes a row's text with it however the row goes: updates, rebuilds and
+                    // revisions being purged all delete from maps_N.
+                    execute (connection, "CREATE VIRTUAL TABLE IF NOT EXISTS '" + fullText + "' USING fts5 (content, tokenize = 'unicode61 remove_diacritics 2')");
+                    execute (connection, "CREATE INDEX IF NOT EXISTS '" + maps + "_fulltext' ON '" + maps + "' (fulltext_id) WHERE fulltext_id IS NOT NULL");
+                    createFullTextTrigger (connection, viewId);
+
+                    insertText = std::make_unique<Statement> (connection, "INSERT INTO '" + fullText.toStdString() + "' (content) VALUES (?1)");
+                }
+
+                insertText->bind (1, text);
+                insertText->step();
+                insertText->reset();
+                return sqlite3_last_insert_rowid (connection);
+            }
+
+            auto addBounds (const std::array<double, 4>& box) -> sqlite3_int64
+            {
+                if (insertBounds == nullptr)
+                {
+                    if (! hasRTreeModule (connection))
+                        throw std::runtime_error ("SQLite error: emitBoundingBox needs the R*Tree module, which this build of sqlite doesn't have");
+
+                    const auto maps = getMapsTable (viewId);
+                    const auto boxes = getBoundingBoxTable (viewId);
+
+                    execute (connection, "CREATE VIRTUAL TABLE IF NOT EXISTS '" + boxes + "' USING rtree (id, minX, maxX, minY, maxY)");
+                    execute (connection, "CREATE INDEX IF NOT EXISTS '" + maps + "_bbox' ON '" + maps + "' (bbox_id) WHERE bbox_id IS NOT NULL");
+                    createBoundingBoxTrigger (connection, viewId);
+
+                    insertBounds = std::make_unique<Statement> (connection, "INSERT INTO '" + boxes.toStdString() + "' (minX, maxX, minY, maxY) VALUES (?1, ?2, ?3, ?4)");
+                }
+
+                for (int i = 0; i < 4; ++i)
+                    insertBounds->bind (i + 1, box[static_cast<size_t> (i)]);
+
+                insertBounds->step();
+                insertBounds->reset();
+                return sqlite3_last_insert_rowid (connection);
+            }
+
+            sqlite3* connection;
+            int viewId;
+            Statement insert;
+            std::unique_ptr<Statement> insertText, insertBounds;
+        };
+    }
+
+    auto CouchbaseLiteDatabase::getRegisteredView (const juce::String& name) const -> const RegisteredView*
+    {
+        const auto found = views.find (name);
+        return found != views.end() ? &found->second : nullptr;
+    }
+
+    auto CouchbaseLiteDatabase::registerView (const juce::String& name, const juce::String& version, MapFunction map) -> void
+    {
+        auto connection = db.connection().get();
+        Transaction transaction (connection);
+
+        int viewId = 0;
+        juce::String storedVersion;
+        bool exists = false;
+
+        {
+            Statement find (connection, "SELECT view_id, version FROM views WHERE name = ?1");
+            find.bind (1, name.toStdString());
+
+            if ((exists = find.step()))
+            {
+                viewId = static_cast<int> (find.getInt64 (0));
+                storedVersion = toString (find.getText (1));
+            }
+        }
+
+        if (! exists)
+        {
+            Statement insert (connection, "INSERT INTO views (name, version) VALUES (?1, ?2)");
+            insert.bind (1, name.toStdString()).bind (2, version.toStdString());
+            insert.step();
+            viewId = static_cast<int> (sqlite3_last_insert_rowid (connection));
+        }
+
+        createViewTable (connection, viewId);
+
+        if (exists && storedVersion != version)
+        {
+            execute (connection, "DELETE FROM '" + getMapsTable (viewId) + "'");
+            execute (connection, "DELETE FROM '" + getReduceTable (viewId) + "'");
+
+            Statement reset (connection, "UPDATE views SET version = ?1, lastsequence = 0, total_docs = -1 WHERE view_id = ?2");
+            reset.bind (1, version.toStdString()).bind (2, static_cast<sqlite3_int64> (viewId));
+            reset.step();
+        }
+
+        transaction.commit();
+        views[name] = { viewId, std::move (map) };
+    }
+
+    auto CouchbaseLiteDatabase::updateView (const juce::String& name) -> ViewUpdateStats
+    {
+        ViewUpdateStats stats;
+
+        const auto* view = getRegisteredView (name);
+        if (view == nullptr)
+        {
+            jassertfalse; // registerView first
+            return stats;
+        }
+
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        const auto table = getMapsTable (view->viewId);
+        auto connection = db.connection().get();
+        Transaction transaction (connection);
+
+        sqlite3_int64 lastSequence = 0, totalRows = -1, maxSequence = 0;
+        {
+            Statement state (connection, "SELECT lastsequence, total_docs, (SELECT IFNULL(MAX(sequence), 0) FROM revs) FROM views WHERE view_id = ?1");
+            state.bind (1, static_cast<sqlite3_int64> (view->viewId));
+
+            if (state.step())
+            {
+                lastSequence = state.getInt64 (0);
+                totalRows = state.isNull (1) ? -1 : state.getInt64 (1);
+                maxSequence = state.getInt64 (2);
+            }
+        }
+
+        stats.lastSequence = maxSequence;
+
+        if (lastSequence >= maxSequence)
+            return stats;
+
+        // Every document with a revision newer than lastsequence gets all its rows dropped and its winner
+        // mapped again: a new revision can supersede, conflict with or delete the one that was indexed.
+        const std::string changedRows = " FROM '" + table.toStdString() + "' WHERE sequence IN"
+                                        " (SELECT sequence FROM revs WHERE doc_id IN (SELECT doc_id FROM revs WHERE sequence > ?1))";
+        ReduceCacheUpdater reduceCache (connection, view->viewId);
+
+        if (reduceCache.isActive())
+        {
+            Statement removed (connection, "SELECT key, value" + changedRows);
+            removed.bind (1, lastSequence);
+
+            while (removed.step())
+                reduceCache.remove (removed.getText (0), removed.getText (1));
+
+            reduceCache.dropEmptyGroups();
+        }
+
+        {
+            Statement remove (connection, "DELETE" + changedRows);
+            remove.bind (1, lastSequence);
+            remove.step();
+            stats.rowsDeleted = sqlite3_changes (connection);
+        }
+
+        // Winner first for each document: live before deleted, then the highest revid
+        Statement changed (connection, "SELECT revs.doc_id, revs.sequence, docs.docid, revs.revid, revs.json, revs.doc_type, revs.deleted"
+                                       " FROM revs JOIN docs ON docs.doc_id = revs.doc_id"
+                                       " WHERE revs.current = 1 AND revs.doc_id IN (SELECT doc_id FROM revs WHERE sequence > ?1)"
+                                       " ORDER BY revs.doc_id, revs.deleted, revs.revid DESC");
+        changed.bind (1, lastSequence);
+
+        MapsWriter maps (connection, view->viewId);
+
+        ViewEmitter emitter;
+        sqlite3_int64 previousDocument = -1;
+
+        while (changed.step())
+        {
+            const auto document = changed.getInt64 (0);
+            if (document == previousDocument)
+                continue;
+
+            previousDocument = document;
+
+            const auto docId = changed.getText (2);
+            if (changed.getInt64 (6) != 0 || docId.starts_with ("_design/"))
+                continue;
+
+            const auto doc = makeDocument (toString (changed.getText (4)), toString (docId), toString (changed.getText (3)), toString (changed.getText (5)));
+            if (! doc.isObject())
+                continue;
+
+            emitter.clear();
+            view->map (doc, emitter);
+            ++stats.documentsMapped;
+
+            const auto sequence = changed.getInt64 (1);
+
+            for (auto& row : emitter.getRows())
+            {
+                const auto key = row.key.toStdString();
+                const auto value = row.value.toStdString();
+                maps.add (sequence, key, value, row.text.toStdString(), row.bounds);
+                ++stats.rowsEmitted;
+
+                if (reduceCache.isActive())
+                    reduceCache.add (key, value);
+            }
+        }
+
+        if (totalRows < 0)
+        {
+            Statement count (connection, "SELECT COUNT(*) FROM '" + table.toStdString() + "'");
+            count.step();
+            totalRows = count.getInt64 (0);
+        }
+        else
+        {
+            totalRows += stats.rowsEmitted - stats.rowsDeleted;
+        }
+
+        Statement save (connection, "UPDATE views SET lastsequence = ?1, total_docs = ?2 WHERE view_id = ?3");
+        save.bind (1, maxSequence).bind (2, totalRows).bind (3, static_cast<sqlite3_int64> (view->viewId));
+        save.step();
+
+        transaction.commit();
+
+        stats.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return stats;
+    }
+
+    auto CouchbaseLiteDatabase::rebuildView (const juce::String& name, int numThreads) -> ViewUpdateStats
+    {
+        const auto* view = getRegisteredView (name);
+        if (view == nullptr)
+        {
+            jassertfalse; // registerView first
+            return {};
+        }
+
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        const auto table = getMapsTable (view->viewId).toStdString();
+        const auto viewId = static_cast<sqlite3_int64> (view->viewId);
+        auto connection = db.connection().get();
+
+        bool isWal = false;
+        {
+            Statement journalMode (connection, "PRAGMA journal_mode");
+            isWal = journalMode.step() && juce::String (toString (journalMode.getText (0))).equalsIgnoreCase ("wal");
+        }
+
+        if (! isWal)
+        {
+            Transaction transaction (connection);
+            execute (connection, "DELETE FROM '" + table + "'");
+            execute (connection, "DELETE FROM '" + getReduceTable (view->viewId) + "'");
+
+            Statement reset (connection, "UPDATE views SET lastsequence = 0, total_docs = 0 WHERE view_id = ?1");
+            reset.bind (1, viewId).step();
+
+            transaction.commit();
+            return updateView (name);
+        }
+
+        // The indexes are dropped while the table fills up and built again at the end, which is much
+        // cheaper than keeping the JSON-collated key index up to date row by row. If this throws halfway,
+        // lastsequence is left at 0 so the next update starts over, and the indexes are put back before
+        // the exception goes on, so queries until then don't scan the whole table.
+        sqlite3_int64 maxSequence = 0, rowsDeleted = 0;
+        {
+            Transaction transaction (connection);
+            execute (connection, "DELETE FROM '" + table + "'");
+            rowsDeleted = sqlite3_changes (connection);
+            execute (connection, "DELETE FROM '" + getReduceTable (view->viewId) + "'");
+            execute (connection, "DROP INDEX IF EXISTS '" + table + "_keys'");
+            execute (connection, "DROP INDEX IF EXISTS '" + table + "_sequence'");
+
+            Statement reset (connection, "UPDATE views SET lastsequence = 0, total_docs = -1 WHERE view_id = ?1");
+            reset.bind (1, viewId).step();
+
+            Statement last (connection, "SELECT IFNULL(MAX(sequence), 0) FROM revs");
+            last.step();
+            maxSequence = last.getInt64 (0);
+
+            transaction.commit();
+        }
+
+        ViewUpdateStats stats;
+        stats.lastSequence = maxSequence;
+        stats.rowsDeleted = rowsDeleted;
+        stats.threads = numThreads > 0 ? numThreads : juce::jmax (1, juce::SystemStats::getNumCpus());
+
+        static constexpr sqlite3_int64 sequencesPerChunk = 4096;
+        static constexpr size_t rowsPerBatch = 1024;
+        static constexpr juce::int64 rowsPerTransaction = 200000;
+
+        RowQueue queue (static_cast<size_t> (stats.threads) * 4, stats.threads);
+        std::atomic<sqlite3_int64> nextChunk { 0 };
+        std::atomic<juce::int64> documentsMapped { 0 };
+        std::mutex errorLock;
+        std::exception_ptr error;
+
+        // Winners only: a live current revision with no live current sibling that has a higher revid.
+        // Each worker has its own read transaction, so a revision written during the rebuild may be
+        // missed; it is past maxSequence, so the next updateView maps it.
+        const auto mapRange = [&]
+        {
+            try
+            {
+                auto reader = openReadConnection (dbFile);
+                Statement winners (reader.get(), "SELECT revs.sequence, docs.docid, revs.revid, revs.json, revs.doc_type"
+                                                 " FROM revs JOIN docs ON docs.doc_id = revs.doc_id"
+                                                 " WHERE revs.sequence BETWEEN ?1 AND ?2 AND revs.current = 1 AND revs.deleted = 0"
+                                                 " AND NOT EXISTS (SELECT 1 FROM revs AS better WHERE better.doc_id = revs.doc_id"
+                                                 " AND better.current = 1 AND better.deleted = 0 AND better.revid > revs.revid)");
+                ViewEmitter emitter;
+                RowBatch batch;
+                batch.reserve (rowsPerBatch);
+
+                for (;;)
+                {
+                    const auto first = nextChunk++ * sequencesPerChunk + 1;
+                    if (first > maxSequence)
+                        break;
+
+                    winners.reset();
+                    winners.bind (1, first).bind (2, juce::jmin (first + sequencesPerChunk - 1, maxSequence));
+
+                    while (winners.step())
+                    {
+                        const auto docId = winners.getText (1);
+                        if (docId.starts_with ("_design/"))
+                            continue;
+
+                        const auto doc = makeDocument (toString (winners.getText (3)), toString (docId), toString (winners.getText (2)), toString (winners.getText (4)));
+                        if (! doc.isObject())
+                            continue;
+
+                        emitter.clear();
+                        view->map (doc, emitter);
+                        ++documentsMapped;
+
+                        for (auto& row : emitter.getRows())
+                            batch.push_back ({ winners.getInt64 (0), row.key.toStdString(), row.value.toStdString(), row.text.toStdString(), row.bounds });
+
+                        if (batch.size() >= rowsPerBatch)
+                        {
+                            if (! queue.push (std::move (batch)))
+                            {
+                                queue.producerFinished();
+                                return;
+                            }
+
+                            batch = {};
+                            batch.reserve (rowsPerBatch);
+                        }
+                    }
+                }
+
+                if (! batch.empty())
+                    queue.push (std::move (batch));
+            }
+            catch (...)
+            {
+                const std::lock_guard lock (errorLock);
+                if (error == nullptr)
+                    error = std::current_exception();
+
+                queue.cancel();
+            }
+
+            queue.producerFinished();
+        };
+
+        std::vector<std::thread> workers;
+
+        const auto joinWorkers = [&]
+        {
+            for (auto& worker : workers)
+                worker.join();
+        };
+
+        try
+        {
+            for (int i = 0; i < stats.threads; ++i)
+                workers.emplace_back (mapRange);
+
+            auto transaction = std::make_unique<Transaction> (connection);
+            MapsWriter maps (connection, view->viewId);
+            juce::int64 rowsInTransaction = 0;
+            RowBatch batch;
+
+            while (queue.pop (batch))
+            {
+                for (auto& row : batch)
+                    maps.add (row.sequence, row.key, row.value, row.text, row.bounds);
+
+                stats.rowsEmitted += static_cast<juce::int64> (batch.size());
+                rowsInTransaction += static_cast<juce::int64> (batch.size());
+
+                // Committing now and then lets the WAL be checkpointed instead of growing by the whole index
+                if (rowsInTransaction >= rowsPerTransaction)
+                {
+                    transaction->commit();
+                    transaction = std::make_unique<Transaction> (connection);
+                    rowsInTransaction = 0;
+                }
+            }
+
+            joinWorkers();
+            workers.clear();
+
+            if (error != nullptr)
+                std::rethrow_exception (error);
+
+            createViewTable (connection, view->viewId);
+
+            Statement save (connection, "UPDATE views SET lastsequence = ?1, total_docs = ?2 WHERE view_id = ?3");
+            save.bind (1, maxSequence).bind (2, stats.rowsEmitted).bind (3, viewId).step();
+
+            transaction->commit();
+        }
+        catch (...)
+        {
+            queue.cancel();
+            joinWorkers();
+
+            try
+            {
+                createViewTable (connection, view->viewId);
+            }
+            catch (...)
+            {
+                // e.g. the disk is full; the original error is the one worth reporting
+            }
+
+            throw;
+        }
+
+        stats.documentsMapped = documentsMapped;
+        stats.seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+        return stats;
+    }
+
+    auto CouchbaseLiteDatabase::findView (const juce::String& name, bool bringUpToDate) -> int
+    {
+        if (const auto* view = getRegisteredView (name))
+        {
+            if (bringUpToDate)
+                updateView (name);
+
+            return view->viewId;
+        }
+
+        Statement find (db.connection().get(), "SELECT view_id FROM views WHERE name = ?1");
+        find.bind (1, name.toStdString());
+        return find.step() ? static_cast<int> (find.getInt64 (0)) : 0;
+    }
+
+    auto CouchbaseLiteDatabase::queryView (const juce::String& name, const ViewQueryOptions& options) -> ViewCursor
+    {
+        const int viewId = findView (name, ! options.stale);
+        if (viewId == 0)
+            return {};
+
+        // Only our own updates keep the cache current, so it is no use for views Couchbase Lite maintains
+        if (options.cached && options.reduce != ViewQueryOptions::Reducer::none && options.keys.isEmpty() && getRegisteredView (name) != nullptr)
+            return queryReduceCache (viewId, options);
+
+        return openViewQuery (viewId, options, getKeyRange (options));
+    }
+
+    auto CouchbaseLiteDatabase::searchText (const juce::String& viewName, const juce::String& query, int limit) -> juce::StringArray
+    {
+        juce::StringArray docIds;
+
+        const int viewId = findView (viewName, true);
+        if (viewId == 0)
+            return docIds;
+
+        auto connection = db.connection().get();
+        const auto fullText = getFullTextTable (viewId).toStdString();
+
+        if (! hasFullTextModule (connection))
+            throw std::runtime_error ("SQLite error: searchText needs FTS5, which this build of sqlite doesn't have");
+
+        if (! tableExists (connection, fullText))
+            return docIds;  // nothing has emitted text yet
+
+        // rank is bm25() for an FTS5 table, lower being better. A document with several matching rows
+        // ranks by its best one.
+        Statement search (connection, "SELECT docs.docid, MIN(f.rank) AS score FROM '" + fullText + "' AS f"
+                                      " JOIN '" + getMapsTable (viewId).toStdString() + "' AS m ON m.fulltext_id = f.rowid"
+                                      " JOIN revs ON revs.sequence = m.sequence JOIN docs ON docs.doc_id = revs.doc_id"
+                                      " WHERE f.content MATCH ?1 GROUP BY docs.doc_id ORDER BY score LIMIT ?2");
+        search.bind (1, query.toStdString()).bind (2, static_cast<sqlite3_int64> (limit));
+
+        while (search.step())
+            docIds.add (toString (search.getText (0)));
+
+        return docIds;
+    }
+
+    auto CouchbaseLiteDatabase::queryBoundingBox (const juce::String& viewName, juce::Rectangle<double> area, int limit) -> std::vector<SpatialRow>
+    {
+        std::vector<SpatialRow> rows;
+
+        const int viewId = findView (viewName, true);
+        if (viewId == 0)
+            return rows;
+
+        auto connection = db.connection().get();
+        const auto boxes = getBoundingBoxTable (viewId).toStdString();
+
+        if (! hasRTreeModule (connection))
+            throw std::runtime_error ("SQLite error: queryBoundingBox needs the R*Tree module, which this build of sqlite doesn't have");
+
+        if (! tableExists (connection, boxes))
+            return rows;    // nothing has emitted a box yet
+
+        Statement overlapping (connection, "SELECT docs.docid, m.value, m.geokey FROM '" + boxes + "' AS b"
+                                           " JOIN '" + getMapsTable (viewId).toStdString() + "' AS m ON m.bbox_id = b.id"
+                                           " JOIN revs ON revs.sequence = m.sequence JOIN docs ON docs.doc_id = revs.doc_id"
+                                           " WHERE b.maxX >= ?1 AND b.minX <= ?2 AND b.maxY >= ?3 AND b.minY <= ?4");
+        overlapping.bind (1, area.getX()).bind (2, area.getRight()).bind (3, area.getY()).bind (4, area.getBottom());
+
+        // The R*Tree's float boxes are a superset, e.g. millisecond timestamps only keep about two minutes
+        // of precision, so the exact box in geokey decides.
+        while ((limit < 0 || static_cast<int> (rows.size()) < limit) && overlapping.step())
+        {
+            const auto geokey = overlapping.getBlob (2);
+            std::array<double, 4> exact;
+
+            if (geokey.size() != sizeof (exact))
+                continue;
+
+            std::memcpy (exact.data(), geokey.data(), sizeof (exact));
+
+            if (exact[1] < area.getX() || exact[0] > area.getRight() || exact[3] < area.getY() || exact[2] > area.getBottom())
+                continue;
+
+            rows.push_back ({ toString (overlapping.getText (0)),
+                              juce::Rectangle<double>::leftTopRightBottom (exact[0], exact[2], exact[1], exact[3]),
+                              juce::JSON::parse (toString (overlapping.getText (1))) });
+        }
+
+        return rows;
+    }
+
+    auto CouchbaseLiteDatabase::getKeyRange (const ViewQueryOptions& options) -> KeyRange
+    {
+        KeyRange range;
+        const auto& low = options.descending ? options.endKey : options.startKey;
+        const auto& high = options.descending ? options.startKey : options.endKey;
+
+        if (low.has_value())
+            range.low = juce::JSON::toString (*low, true).toStdString();
+
+        if (high.has_value())
+            range.high = juce::JSON::toString (*high, true).toStdString();
+
+        range.lowInclusive = ! options.descending || options.inclusiveEnd;
+        range.highInclusive = options.descending || options.inclusiveEnd;
+        range.descending = options.descending;
+        return range;
+    }
+
+    auto CouchbaseLiteDatabase::openViewQuery (int viewId, const ViewQueryOptions& options, const KeyRange& range) -> ViewCursor
+    {
+        auto connection = db.connection().get();
+        std::string sql = "SELECT m.key, m.value, docs.docid FROM '" + getMapsTable (viewId).toStdString() + "' AS m"
+                          " JOIN revs ON revs.sequence = m.sequence JOIN docs ON docs.doc_id = revs.doc_id";
+
+        if (! options.keys.isEmpty())
+        {
+            sql += " WHERE m.key = ?1 ORDER BY m.rowid";
+            return ViewCursor (std::make_unique<Statement> (connection, sql), options);
+        }
+
+        // key is declared COLLATE JSON, so these compare as JSON and run as a range on maps_N_keys
+        std::vector<std::string> bounds;
+
+        if (range.low.has_value())
+        {
+            bounds.push_back (*range.low);
+            sql += std::string (" WHERE m.key ") + (range.lowInclusive ? ">=" : ">") + " ?1";
+        }
+
+        if (range.high.has_value())
+        {
+            bounds.push_back (*range.high);
+            sql += std::string (bounds.size() == 1 ? " WHERE" : " AND") + " m.key " + (range.highInclusive ? "<=" : "<") + " ?" + std::to_string (bounds.size());
+        }
+
+        const std::string direction = range.descending ? " DESC" : "";
+        sql += " ORDER BY m.key" + direction + ", m.rowid" + direction;
+
+        if (options.reduce == ViewQueryOptions::Reducer::none)
+            sql += " LIMIT " + std::to_string (options.limit) + " OFFSET " + std::to_string (juce::jmax (0, options.skip));
+
+        auto statement = std::make_unique<Statement> (connection, sql);
+        for (size_t i = 0; i < bounds.size(); ++i)
+            statement->bind (static_cast<int> (i + 1), bounds[i]);
+
+        return ViewCursor (std::move (statement), options);
+    }
+
+    auto CouchbaseLiteDatabase::buildReduceCache (int viewId, int level) -> void
+    {
+        auto connection = db.connection().get();
+        Transaction transaction (connection);
+
+        ViewQueryOptions everything;
+        everything.reduce = ViewQueryOptions::Reducer::stats;
+        everything.group = level < 0;
+        everything.groupLevel = juce::jmax (0, level);
+
+        Statement insert (connection, "INSERT OR REPLACE INTO '" + getReduceTable (viewId).toStdString() + "'"
+                                      " (level, key, count, sum, sumsqr, min, max, stale) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, 0)");
+
+        for (auto groups = openViewQuery (viewId, everything, {}); groups.next();)
+        {
+            bindTotals (insert, level, groups.getKeyJson(), groups.totals);
+            insert.step();
+            insert.reset();
+        }
+
+        transaction.commit();
+    }
+
+    auto CouchbaseLiteDatabase::queryReduceCache (int viewId, const ViewQueryOptions& options) -> ViewCursor
+    {
+        auto connection = db.connection().get();
+        const auto table = getReduceTable (viewId).toStdString();
+        const int level = getGroupLevel (options);
+
+        {
+            Statement built (connection, "SELECT 1 FROM '" + table + "' WHERE level = ?1 LIMIT 1");
+            built.bind (1, static_cast<sqlite3_int64> (level));
+
+            if (! built.step())
+                buildReduceCache (viewId, level);
+        }
+
+        // The groups at either end of the range may be only partly inside it, so they are reduced from
+        // their rows, which stops at the end of the group. The ones in between are whole, so they come
+        // straight from the cache.
+        const auto range = getKeyRange (options);
+        auto firstOnly = options;
+        firstOnly.skip = 0;
+        firstOnly.limit = 1;
+
+        auto first = openViewQuery (viewId, firstOnly, range);
+        if (! first.next())
+            return {};
+
+        ViewCursor::ReducedRows rows;
+        rows.push_back ({ std::string (first.getKeyJson()), first.getValue() });
+
+        auto reversed = range;
+        reversed.descending = ! range.descending;
+        auto last = openViewQuery (viewId, firstOnly, reversed);
+        last.next();
+
+        const std::string lastKey (last.getKeyJson());
+        if (collateJSON (rows.front().first, lastKey) == 0)
+            return ViewCursor (std::move (rows), options);
+
+        struct CachedGroup
+        {
+            std::string key;
+            ReduceTotals totals;
+            bool stale;
+        };
+
+        std::vector<CachedGroup> groups;
+        {
+            Statement between (connection, "SELECT key, count, sum, sumsqr, min, max, stale FROM '" + table + "'"
+                                           " WHERE level = ?1 AND key > ?2 AND key < ?3 ORDER BY key" + (range.descending ? " DESC" : ""));
+            between.bind (1, static_cast<sqlite3_int64> (level))
+                   .bind (2, range.descending ? lastKey : rows.front().first)
+                   .bind (3, range.descending ? rows.front().first : lastKey);
+
+            while (between.step())
+                groups.push_back ({ std::string (between.getText (0)),
+                                    { between.getInt64 (1), between.getDouble (2), between.getDouble (3), between.getDouble (4), between.getDouble (5), ! between.isNull (4) },
+                                    between.getInt64 (6) != 0 });
+        }
+
+        // Removing a group's smallest or largest value leaves its min and max unknown until it is reduced again
+        Statement refresh (connection, "UPDATE '" + table + "' SET count = ?3, sum = ?4, sumsqr = ?5, min = ?6, max = ?7, stale = 0 WHERE level = ?1 AND key = ?2");
+
+        for (auto& group : groups)
+        {
+            if (group.stale)
+            {
+                KeyRange fromGroup;
+                fromGroup.low = group.key;
+
+                auto regroup = firstOnly;
+                regroup.reduce = ViewQueryOptions::Reducer::stats;
+
+                auto rowsOfGroup = openViewQuery (viewId, regroup, fromGroup);
+                if (rowsOfGroup.next())
+                    group.totals = rowsOfGroup.totals;
+
+                bindTotals (refresh, level, group.key, group.totals);
+                refresh.step();
+                refresh.reset();
+            }
+
+            rows.push_back ({ group.key, makeReducedValue (options.reduce, group.totals) });
+        }
+
+        rows.push_back ({ lastKey, last.getValue() });
+        return ViewCursor (std::move (rows), options);
+    }
+}
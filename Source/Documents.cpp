@@ -0,0 +1,290 @@
+#include "Documents.h"
+#include "JsonReader.h"
+
+namespace db {
+
+    namespace {
+
+        /** Calls readMember (key) for each member of the object the reader is on; readMember has to read
+            or skip the value. Anything other than an object is skipped. */
+        template <typename Callback>
+        auto forEachMember (JsonReader& reader, Callback&& readMember) -> void
+        {
+            if (! reader.enterObject())
+                return;
+
+            std::string_view key;
+            while (reader.nextKey (key))
+                readMember (key);
+        }
+
+        /** Calls readElement() for each element of the array the reader is on; readElement has to read or
+            skip it. Anything other than an array is skipped. */
+        template <typename Callback>
+        auto forEachElement (JsonReader& reader, Callback&& readElement) -> void
+        {
+            if (! reader.enterArray())
+                return;
+
+            while (reader.nextElement())
+                readElement();
+        }
+
+        auto decodeAttachments (JsonReader& reader, std::vector<AttachmentInfo>& attachments) -> void
+        {
+            // Reuse the entries (and their strings) left over from the previous document
+            size_t count = 0;
+
+            forEachMember (reader, [&] (std::string_view name)
+            {
+                if (count == attachments.size())
+                    attachments.emplace_back();
+
+                auto& attachment = attachments[count++];
+                attachment.name.assign (name);
+                attachment.digest.clear();
+                attachment.contentType.clear();
+                attachment.length = 0;
+                attachment.stub = false;
+
+                forEachMember (reader, [&] (std::string_view key)
+                {
+                    if      (key == "digest")       reader.read (attachment.digest);
+                    else if (key == "content_type") reader.read (attachment.contentType);
+                    else if (key == "length")       reader.read (attachment.length);
+                    else if (key == "stub")         reader.read (attachment.stub);
+                    else                            reader.skip();
+                });
+            });
+
+            attachments.resize (count);
+        }
+
+        auto decodeAudio (JsonReader& reader, Loop::Audio& audio) -> void
+        {
+            forEachMember (reader, [&] (std::string_view key)
+            {
+                if      (key == "key")    reader.read (audio.key);
+                else if (key == "url")    reader.read (audio.url);
+                else if (key == "mime")   reader.read (audio.mime);
+                else if (key == "length") reader.read (audio.length);
+                else                      reader.skip();
+            });
+        }
+
+        auto decodePlayback (JsonReader& reader, std::array<Riff::Slot, 8>& slots) -> void
+        {
+            size_t index = 0;
+
+            forEachElement (reader, [&] ()
+            {
+                if (index == slots.size())
+                {
+                    reader.skip();
+                    return;
+                }
+
+                auto& slot = slots[index++];
+
+                forEachMember (reader, [&] (std::string_view key)
+                {
+                    if (key != "slot")
+                        return (void) reader.skip();
+
+                    forEachMember (reader, [&] (std::string_view slotKey)
+                    {
+                        if (slotKey != "current")
+                            return (void) reader.skip();
+
+                        forEachMember (reader, [&] (std::string_view currentKey)
+                        {
+                            if      (currentKey == "currentLoop") reader.read (slot.loopId);
+                            else if (currentKey == "gain")        reader.read (slot.gain);
+                            else if (currentKey == "on")          reader.read (slot.on);
+                            else                                  reader.skip();
+                        });
+                    });
+                });
+            });
+        }
+
+        auto clearAudio (Loop::Audio& audio) -> void
+        {
+            audio.key.clear();
+            audio.url.clear();
+            audio.mime.clear();
+            audio.length = 0;
+        }
+    }
+
+    auto toString (std::string_view text) -> juce::String
+    {
+        return juce::String::fromUTF8 (text.data(), static_cast<int> (text.size()));
+    }
+
+    auto makeDocument (const juce::String& json, const juce::String& docId, const juce::String& revId, const juce::String& type) -> juce::var
+    {
+        juce::var document = juce::JSON::parse (json);
+        jassert (document.isObject());
+        if (auto obj = document.getDynamicObject())
+        {
+            if (type.isNotEmpty())
+                obj->setProperty ("type", type);
+            obj->setProperty ("_rev", revId);
+            obj->setProperty ("_id", docId);
+        }
+        return document;
+    }
+
+    DocumentView::DocumentView (std::unique_ptr<Statement> statementOnRow)
+        : statement (std::move (statementOnRow)),
+          row { statement->getText (0), statement->getText (1), statement->getText (2), statement->getText (3) },
+          json (row.json)
+    {
+    }
+
+    auto decode (std::string_view json, Riff& riff) -> bool
+    {
+        riff.created = 0;
+        riff.userName.clear();
+        riff.appVersion = 0;
+        riff.root = 0;
+        riff.scale = 0;
+        riff.magnitude = 0.0f;
+        riff.bps = 0.0;
+        riff.barLength = 0;
+
+        for (auto& slot : riff.slots)
+        {
+            slot.loopId.clear();
+            slot.gain = 0.0f;
+            slot.on = false;
+        }
+
+        JsonReader reader (json);
+        bool hasAttachments = false;
+
+        forEachMember (reader, [&] (std::string_view key)
+        {
+            if      (key == "created")      reader.read (riff.created);
+            else if (key == "userName")     reader.read (riff.userName);
+            else if (key == "app_version")  reader.read (riff.appVersion);
+            else if (key == "root")         reader.read (riff.root);
+            else if (key == "scale")        reader.read (riff.scale);
+            else if (key == "magnitude")    reader.read (riff.magnitude);
+            else if (key == "_attachments") { decodeAttachments (reader, riff.attachments); hasAttachments = true; }
+            else if (key == "state")
+            {
+                forEachMember (reader, [&] (std::string_view stateKey)
+                {
+                    if      (stateKey == "bps")       reader.read (riff.bps);
+                    else if (stateKey == "barLength") reader.read (riff.barLength);
+                    else if (stateKey == "playback")  decodePlayback (reader, riff.slots);
+                    else                              reader.skip();
+                });
+            }
+            else
+            {
+                reader.skip();
+            }
+        });
+
+        if (! hasAttachments)
+            riff.attachments.clear();
+
+        return reader.isValid();
+    }
+
+    auto decode (std::string_view json, Loop& loop) -> bool
+    {
+        loop.created = 0;
+        loop.createdBy.clear();
+        loop.creatorUserName.clear();
+        loop.presetName.clear();
+        loop.primaryColour.clear();
+        loop.bps = 0.0;
+        loop.barLength = 0;
+        loop.length = 0;
+        loop.sampleRate = 0;
+        loop.originalPitch = 0.0;
+        loop.isDrum = false;
+        loop.isNote = false;
+        loop.isBass = false;
+        loop.isMic = false;
+        clearAudio (loop.oggAudio);
+        clearAudio (loop.flacAudio);
+
+        JsonReader reader (json);
+        bool hasAttachments = false;
+
+        forEachMember (reader, [&] (std::string_view key)
+        {
+            if      (key == "created")         reader.read (loop.created);
+            else if (key == "createdBy")       reader.read (loop.createdBy);
+            else if (key == "creatorUserName") reader.read (loop.creatorUserName);
+            else if (key == "presetName")      reader.read (loop.presetName);
+            else if (key == "primaryColour")   reader.read (loop.primaryColour);
+            else if (key == "bps")             reader.read (loop.bps);
+            else if (key == "barLength")       reader.read (loop.barLength);
+            else if (key == "length")          reader.read (loop.length);
+            else if (key == "sampleRate")      reader.read (loop.sampleRate);
+            else if (key == "originalPitch")   reader.read (loop.originalPitch);
+            else if (key == "isDrum")          reader.read (loop.isDrum);
+            else if (key == "isNote")          reader.read (loop.isNote);
+            else if (key == "isBass")          reader.read (loop.isBass);
+            else if (key == "isMic")           reader.read (loop.isMic);
+            else if (key == "_attachments")    { decodeAttachments (reader, loop.attachments); hasAttachments = true; }
+            else if (key == "cdn_attachments")
+            {
+                forEachMember (reader, [&] (std::string_view format)
+                {
+                    if      (format == "oggAudio")  decodeAudio (reader, loop.oggAudio);
+                    else if (format == "flacAudio") decodeAudio (reader, loop.flacAudio);
+                    else                            reader.skip();
+                });
+            }
+            else
+            {
+                reader.skip();
+            }
+        });
+
+        if (! hasAttachments)
+            loop.attachments.clear();
+
+        return reader.isValid();
+    }
+
+    auto decodeAttachments (std::string_view json, std::vector<AttachmentInfo>& attachments) -> bool
+    {
+        JsonReader reader (json);
+        bool hasAttachments = false;
+
+        forEachMember (reader, [&] (std::string_view key)
+        {
+            if (key == "_attachments")
+            {
+                decodeAttachments (reader, attachments);
+                hasAttachments = true;
+            }
+            else
+            {
+                reader.skip();
+            }
+        });
+
+        if (! hasAttachments)
+            attachments.clear();
+
+        return reader.isValid();
+    }
+
+    auto RevisionTree::getHistory (int node) const -> std::vector<int>
+    {
+        std::vector<int> history;
+        for (; node >= 0 && node < static_cast<int> (nodes.size()); node = nodes[static_cast<size_t> (node)].parent)
+            history.push_back (node);
+
+        return history;
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <JuceHeader.h>
+#include "JsonView.h"
+#include "SqliteStatement.h"
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace db {
+
+    auto toString (std::string_view text) -> juce::String;
+
+    /** Turns a revision row into the var we hand out: the json body plus _id, _rev and type. */
+    auto makeDocument (const juce::String& json, const juce::String& docId, const juce::String& revId, const juce::String& type) -> juce::var;
+
+    /** A current revision as it comes off the sqlite step loop. The views point into the statement's
+        column buffers, so they are only valid until the callback they are passed to returns. */
+    struct RevisionRow
+    {
+        std::string_view docId;
+        std::string_view revId;
+        std::string_view json;
+        std::string_view type;
+    };
+
+    /** A current revision read in place, with a lazy view of its json.
+
+        It holds on to the statement that read it, still positioned on the row, so the views point
+        straight into sqlite's column buffer and nothing is copied. That keeps the statement's read
+        transaction open as long as the DocumentView lives: with a WAL database checkpoints can't get
+        past it, and with a rollback journal nobody can write. Don't keep one around longer than needed.
+    */
+    class DocumentView
+    {
+    public:
+        DocumentView() = default;
+
+        auto exists() const -> bool                 { return statement != nullptr; }
+        auto getRow() const -> const RevisionRow&   { return row; }
+        auto getJson() const -> const JsonView&     { return json; }
+
+        auto operator[] (std::string_view key) const -> JsonView { return json[key]; }
+
+    private:
+        friend struct CouchbaseLiteDatabase;
+        explicit DocumentView (std::unique_ptr<Statement> statementOnRow);
+
+        std::unique_ptr<Statement> statement;
+        RevisionRow row;
+        JsonView json;
+    };
+
+    /** Every revision of a document as a flat array, parents before their children, for history views
+        and looking into conflicts. The revision IDs are packed one after another into a single string. */
+    struct RevisionTree
+    {
+        struct Node
+        {
+            juce::int64 sequence = 0;
+            int parent = -1;            // index into nodes, -1 for a root or when the parent was pruned
+            uint32_t revIdStart = 0;
+            uint32_t revIdLength = 0;
+            bool deleted = false;
+            bool current = false;       // a leaf: the winning revision or a conflict
+        };
+
+        std::string docId;
+        std::vector<Node> nodes;
+        std::string revIds;
+
+        auto getRevId (const Node& node) const -> std::string_view { return std::string_view (revIds).substr (node.revIdStart, node.revIdLength); }
+
+        /** Indexes of a node and its ancestors, from the node back to the oldest one still stored. */
+        auto getHistory (int node) const -> std::vector<int>;
+    };
+
+    /** A document with more than one live leaf revision, i.e. branches that were edited independently
+        and never merged. */
+    struct DocumentConflict
+    {
+        std::string docId;
+        std::vector<std::string> revIds;    // the live leaves, the winner first
+    };
+
+    /** One entry of a document's _attachments. The data itself lives in the attachments folder, named
+        after the digest. */
+    struct AttachmentInfo
+    {
+        std::string name;
+        std::string digest;         // "sha1-<base64>"
+        std::string contentType;
+        juce::int64 length = 0;
+        bool stub = false;
+    };
+
+    /** An Endlesss riff: one state of a jam, i.e. which loop plays in each of the eight slots. Endlesss
+        spells the document type "Rifff", with three f's. */
+    struct Riff
+    {
+        static constexpr auto typeName = "Rifff";
+
+        struct Slot
+        {
+            std::string loopId;     // state.playback[i].slot.current.currentLoop
+            float gain = 0.0f;
+            bool on = false;
+        };
+
+        std::string docId;
+        std::string revId;
+        juce::int64 created = 0;    // milliseconds since the epoch
+        std::string userName;
+        int appVersion = 0;
+        int root = 0;
+        int scale = 0;
+        float magnitude = 0.0f;
+        double bps = 0.0;           // beats per second
+        int barLength = 0;
+        std::array<Slot, 8> slots;
+        std::vector<AttachmentInfo> attachments;
+    };
+
+    /** An Endlesss "Loop" document: one recorded stem, with its audio either on the CDN or attached. */
+    struct Loop
+    {
+        static constexpr auto typeName = "Loop";
+
+        struct Audio
+        {
+            std::string key;
+            std::string url;
+            std::string mime;
+            juce::int64 length = 0;
+        };
+
+        std::string docId;
+        std::string revId;
+        juce::int64 created = 0;    // milliseconds since the epoch
+        std::string createdBy;
+        std::string creatorUserName;
+        std::string presetName;
+        std::string primaryColour;
+        double bps = 0.0;
+        int barLength = 0;
+        juce::int64 length = 0;     // in samples
+        int sampleRate = 0;
+        double originalPitch = 0.0;
+        bool isDrum = false;
+        bool isNote = false;
+        bool isBass = false;
+        bool isMic = false;
+        Audio oggAudio;             // cdn_attachments.oggAudio
+        Audio flacAudio;            // cdn_attachments.flacAudio
+        std::vector<AttachmentInfo> attachments;
+    };
+
+    /** Decodes a revision's json blob straight into a typed struct, skipping fields it doesn't know and
+        leaving missing ones at their defaults. docId and revId are left alone, as they aren't in the blob.
+
+        The struct is reset first but keeps the capacity of its strings and vectors, so decoding row after
+        row into the same instance hardly allocates once it has warmed up.
+        Returns false if the JSON is malformed.
+    */
+    auto decode (std::string_view json, Riff& riff) -> bool;
+    auto decode (std::string_view json, Loop& loop) -> bool;
+
+    /** Decodes only the _attachments of a revision's json blob, of any type, reusing the entries already
+        in the vector the same way. Returns false if the JSON is malformed. */
+    auto decodeAttachments (std::string_view json, std::vector<AttachmentInfo>& attachments) -> bool;
+}
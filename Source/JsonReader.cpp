@@ -0,0 +1,438 @@
+#include "JsonReader.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace db {
+
+    namespace {
+
+        auto isSpace (char c) -> bool
+        {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+        }
+
+        auto isNumberChar (char c) -> bool
+        {
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+        }
+
+        auto hexValue (char c) -> int
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        auto readHex4 (const char*& p, const char* end) -> int32_t
+        {
+            if (end - p < 4)
+                return -1;
+
+            int32_t value = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                const auto digit = hexValue (*p++);
+                if (digit < 0)
+                    return -1;
+                value = (value << 4) | digit;
+            }
+            return value;
+        }
+
+        auto appendUtf8 (std::string& out, int32_t c) -> void
+        {
+            if (c < 0x80)
+            {
+                out += static_cast<char> (c);
+            }
+            else if (c < 0x800)
+            {
+                out += static_cast<char> (0xc0 | (c >> 6));
+                out += static_cast<char> (0x80 | (c & 0x3f));
+            }
+            else if (c < 0x10000)
+            {
+                out += static_cast<char> (0xe0 | (c >> 12));
+                out += static_cast<char> (0x80 | ((c >> 6) & 0x3f));
+                out += static_cast<char> (0x80 | (c & 0x3f));
+            }
+            else
+            {
+                out += static_cast<char> (0xf0 | (c >> 18));
+                out += static_cast<char> (0x80 | ((c >> 12) & 0x3f));
+                out += static_cast<char> (0x80 | ((c >> 6) & 0x3f));
+                out += static_cast<char> (0x80 | (c & 0x3f));
+            }
+        }
+
+        /** Decodes the body of a string that has escapes in it. Returns false on a malformed escape. */
+        auto unescape (std::string_view body, std::string& out) -> bool
+        {
+            out.clear();
+
+            for (const char* p = body.data(), *end = p + body.size(); p < end;)
+            {
+                if (*p != '\\')
+                {
+                    out += *p++;
+                    continue;
+                }
+
+                if (++p == end)
+                    return false;
+
+                switch (*p++)
+                {
+                    case '"':  out += '"';  break;
+                    case '\\': out += '\\'; break;
+                    case '/':  out += '/';  break;
+                    case 'b':  out += '\b'; break;
+                    case 'f':  out += '\f'; break;
+                    case 'n':  out += '\n'; break;
+                    case 'r':  out += '\r'; break;
+                    case 't':  out += '\t'; break;
+                    case 'u':
+                    {
+                        auto c = readHex4 (p, end);
+                        if (c < 0)
+                            return false;
+
+                        if (c >= 0xd800 && c < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+                        {
+                            auto next = p + 2;
+                            const auto low = readHex4 (next, end);
+                            if (low >= 0xdc00 && low < 0xe000)
+                            {
+                                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                                p = next;
+                            }
+                        }
+
+                        appendUtf8 (out, c);
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    JsonReader::JsonReader (std::string_view json) : p (json.data()), end (json.data() + json.size())
+    {
+    }
+
+    auto JsonReader::fail() -> bool
+    {
+        failed = true;
+        p = end;
+        return false;
+    }
+
+    auto JsonReader::mismatch() -> bool
+    {
+        skip();
+        return false;
+    }
+
+    auto JsonReader::skipWhitespace() -> void
+    {
+        while (p < end && isSpace (*p))
+            ++p;
+    }
+
+    auto JsonReader::peek() -> Type
+    {
+        if (failed)
+            return Type::invalid;
+
+        skipWhitespace();
+
+        if (p == end)
+            return Type::end;
+
+        switch (*p)
+        {
+            case 'n':           return Type::null;
+            case 't': case 'f': return Type::boolean;
+            case '"':           return Type::string;
+            case '[':           return Type::array;
+            case '{':           return Type::object;
+            case ']': case '}': return Type::end;
+            default:            return *p == '-' || (*p >= '0' && *p <= '9') ? Type::number : Type::invalid;
+        }
+    }
+
+    auto JsonReader::scanString (std::string_view& body, bool& hasEscapes) -> bool
+    {
+        const auto start = ++p;
+
+        // Jump from quote to quote; one preceded by an odd number of backslashes is escaped
+        while (auto quote = static_cast<const char*> (std::memchr (p, '"', static_cast<size_t> (end - p))))
+        {
+            auto backslash = quote;
+            while (backslash > start && backslash[-1] == '\\')
+                --backslash;
+
+            p = quote + 1;
+
+            if (((quote - backslash) & 1) == 0)
+            {
+                body = { start, static_cast<size_t> (quote - start) };
+                hasEscapes = std::memchr (start, '\\', body.size()) != nullptr;
+                return true;
+            }
+        }
+
+        return fail();
+    }
+
+    auto JsonReader::scanNumber (std::string_view& text) -> void
+    {
+        const auto start = p;
+        while (p < end && isNumberChar (*p))
+            ++p;
+
+        text = { start, static_cast<size_t> (p - start) };
+    }
+
+    auto JsonReader::scanLiteral (std::string_view literal) -> bool
+    {
+        if (static_cast<size_t> (end - p) < literal.size() || std::string_view (p, literal.size()) != literal)
+            return fail();
+
+        p += literal.size();
+        return true;
+    }
+
+    auto JsonReader::enterObject() -> bool
+    {
+        if (peek() != Type::object)
+            return mismatch();
+
+        ++p;
+        return true;
+    }
+
+    auto JsonReader::nextKey (std::string_view& key) -> bool
+    {
+        if (failed)
+            return false;
+
+        skipWhitespace();
+        if (p < end && *p == ',')
+        {
+            ++p;
+            skipWhitespace();
+        }
+
+        if (p == end)
+            return fail();
+
+        if (*p == '}')
+        {
+            ++p;
+            return false;
+        }
+
+        bool hasEscapes;
+        if (*p != '"' || ! scanString (key, hasEscapes))
+            return fail();
+
+        skipWhitespace();
+        if (p == end || *p != ':')
+            return fail();
+
+        ++p;
+        return true;
+    }
+
+    auto JsonReader::enterArray() -> bool
+    {
+        if (peek() != Type::array)
+            return mismatch();
+
+        ++p;
+        return true;
+    }
+
+    auto JsonReader::nextElement() -> bool
+    {
+        if (failed)
+            return false;
+
+        skipWhitespace();
+        if (p < end && *p == ',')
+        {
+            ++p;
+            skipWhitespace();
+        }
+
+        if (p == end)
+            return fail();
+
+        if (*p == ']')
+        {
+            ++p;
+            return false;
+        }
+
+        return true;
+    }
+
+    auto JsonReader::read (std::string& value) -> bool
+    {
+        if (peek() != Type::string)
+            return mismatch();
+
+        std::string_view body;
+        bool hasEscapes;
+        if (! scanString (body, hasEscapes))
+            return false;
+
+        if (! hasEscapes)
+        {
+            value.assign (body);
+            return true;
+        }
+
+        return unescape (body, value) || fail();
+    }
+
+    auto JsonReader::read (double& value) -> bool
+    {
+        if (peek() != Type::number)
+            return mismatch();
+
+        std::string_view text;
+        scanNumber (text);
+
+        // readDoubleValue wants a terminated string and, unlike strtod, ignores the locale
+        char buffer[64];
+        if (text.size() >= sizeof (buffer))
+            return fail();
+
+        std::memcpy (buffer, text.data(), text.size());
+        buffer[text.size()] = 0;
+
+        juce::CharPointer_ASCII number (buffer);
+        value = juce::CharacterFunctions::readDoubleValue (number);
+        return number.getAddress() == buffer + text.size() || fail();
+    }
+
+    auto JsonReader::read (float& value) -> bool
+    {
+        double number;
+        if (! read (number))
+            return false;
+
+        value = static_cast<float> (number);
+        return true;
+    }
+
+    auto JsonReader::read (juce::int64& value) -> bool
+    {
+        if (peek() != Type::number)
+            return mismatch();
+
+        const auto start = p;
+        std::string_view text;
+        scanNumber (text);
+
+        const auto [last, error] = std::from_chars (text.data(), text.data() + text.size(), value);
+        if (error == std::errc() && last == text.data() + text.size())
+            return true;
+
+        // Written with a fraction or an exponent (or too big): go through double instead
+        p = start;
+        double number;
+        if (! read (number))
+            return false;
+
+        value = static_cast<juce::int64> (std::llround (std::clamp (number, -9.2e18, 9.2e18)));
+        return true;
+    }
+
+    auto JsonReader::read (int& value) -> bool
+    {
+        juce::int64 number;
+        if (! read (number))
+            return false;
+
+        value = static_cast<int> (std::clamp<juce::int64> (number, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()));
+        return true;
+    }
+
+    auto JsonReader::read (bool& value) -> bool
+    {
+        if (peek() != Type::boolean)
+            return mismatch();
+
+        value = *p == 't';
+        return scanLiteral (value ? "true" : "false");
+    }
+
+    auto JsonReader::skip() -> bool
+    {
+        std::string_view ignored;
+        return readRaw (ignored);
+    }
+
+    auto JsonReader::readRaw (std::string_view& value) -> bool
+    {
+        const auto type = peek();
+        const auto start = p;
+        std::string_view body;
+        bool hasEscapes;
+
+        switch (type)
+        {
+            case Type::null:    if (! scanLiteral ("null")) return false; break;
+            case Type::boolean: if (! scanLiteral (*p == 't' ? "true" : "false")) return false; break;
+            case Type::number:  scanNumber (body); break;
+            case Type::string:  if (! scanString (body, hasEscapes)) return false; break;
+
+            case Type::array:
+            case Type::object:
+            {
+                int depth = 0;
+
+                do
+                {
+                    if (*p == '"')
+                    {
+                        if (! scanString (body, hasEscapes))
+                            return false;
+                        continue;
+                    }
+
+                    if (*p == '[' || *p == '{')
+                        ++depth;
+                    else if (*p == ']' || *p == '}')
+                        --depth;
+
+                    ++p;
+                }
+                while (depth > 0 && p < end);
+
+                if (depth > 0)
+                    return fail();
+                break;
+            }
+
+            case Type::end:
+            case Type::invalid:
+            default:
+                return fail();
+        }
+
+        value = { start, static_cast<size_t> (p - start) };
+        return true;
+    }
+}
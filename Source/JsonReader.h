@@ -0,0 +1,74 @@
+#pragma once
+#include <JuceHeader.h>
+#include <string>
+#include <string_view>
+
+namespace db {
+
+    /** A forward-only reader that pulls values out of JSON text one at a time, without building a tree.
+
+        The reader doesn't own the text, which has to stay alive while it is used. Nothing throws: reading a
+        value of the wrong type skips it and returns false, and malformed JSON puts the reader into a failed
+        state where every call returns false. Decoders can therefore read on and check isValid() once at
+        the end. Values that are skipped are only scanned for their extent, not validated.
+    */
+    class JsonReader
+    {
+    public:
+        enum class Type
+        {
+            null,
+            boolean,
+            number,
+            string,
+            array,
+            object,
+            end,        // the end of the text or of the enclosing array or object
+            invalid
+        };
+
+        explicit JsonReader (std::string_view json);
+
+        /** Type of the next value, without consuming it. */
+        auto peek() -> Type;
+
+        /** Enters an object. Call nextKey until it returns false, reading or skipping each member's value. */
+        auto enterObject() -> bool;
+
+        /** Moves on to the next member of the current object, giving its key as it is written in the text
+            (escapes aren't decoded). Returns false, having left the object, when there are no more. */
+        auto nextKey (std::string_view& key) -> bool;
+
+        /** Enters an array. Call nextElement until it returns false, reading or skipping each element. */
+        auto enterArray() -> bool;
+        auto nextElement() -> bool;
+
+        /** Decodes a string into value, reusing its capacity. */
+        auto read (std::string& value) -> bool;
+        auto read (double& value) -> bool;
+        auto read (float& value) -> bool;
+        auto read (juce::int64& value) -> bool;
+        auto read (int& value) -> bool;
+        auto read (bool& value) -> bool;
+
+        /** Steps over the next value, whatever it is. */
+        auto skip() -> bool;
+
+        /** The text of the next value as it is written, which is then skipped. */
+        auto readRaw (std::string_view& value) -> bool;
+
+        auto isValid() const -> bool { return ! failed; }
+
+    private:
+        auto fail() -> bool;
+        auto mismatch() -> bool;
+        auto skipWhitespace() -> void;
+        auto scanString (std::string_view& body, bool& hasEscapes) -> bool;
+        auto scanNumber (std::string_view& text) -> void;
+        auto scanLiteral (std::string_view literal) -> bool;
+
+        const char* p;
+        const char* end;
+        bool failed = false;
+    };
+}
@@ -0,0 +1,137 @@
+#include "JsonView.h"
+
+namespace db {
+
+    JsonView::JsonView (std::string_view json) : text (json)
+    {
+    }
+
+    auto JsonView::getType() const -> Type
+    {
+        const auto type = JsonReader (text).peek();
+        return type == Type::end ? Type::invalid : type;
+    }
+
+    auto JsonView::indexNext() const -> bool
+    {
+        if (indexing == Indexing::notStarted)
+        {
+            scanner = JsonReader (text);
+            const auto type = scanner.peek();
+
+            if (type == Type::object && scanner.enterObject())
+                indexing = Indexing::object;
+            else if (type == Type::array && scanner.enterArray())
+                indexing = Indexing::array;
+            else
+                indexing = Indexing::done;
+        }
+
+        if (indexing == Indexing::done)
+            return false;
+
+        // A malformed value keeps whatever was indexed before the scanner failed
+        Member member;
+        const bool found = indexing == Indexing::object ? scanner.nextKey (member.key) && scanner.readRaw (member.value)
+                                                        : scanner.nextElement() && scanner.readRaw (member.value);
+        if (! found)
+        {
+            indexing = Indexing::done;
+            return false;
+        }
+
+        if (numMembers < firstMembers.size())
+            firstMembers[numMembers] = member;
+        else
+            moreMembers.push_back (member);
+
+        ++numMembers;
+        return true;
+    }
+
+    auto JsonView::getMember (size_t index) const -> const Member&
+    {
+        return index < firstMembers.size() ? firstMembers[index] : moreMembers[index - firstMembers.size()];
+    }
+
+    auto JsonView::operator[] (std::string_view key) const -> JsonView
+    {
+        if (! isObject())
+            return {};
+
+        for (size_t i = 0; i < numMembers; ++i)
+            if (getMember (i).key == key)
+                return JsonView (getMember (i).value);
+
+        while (indexNext())
+            if (getMember (numMembers - 1).key == key)
+                return JsonView (getMember (numMembers - 1).value);
+
+        return {};
+    }
+
+    auto JsonView::operator[] (int index) const -> JsonView
+    {
+        if (index < 0)
+            return {};
+
+        while (numMembers <= static_cast<size_t> (index))
+            if (! indexNext())
+                return {};
+
+        return JsonView (getMember (static_cast<size_t> (index)).value);
+    }
+
+    auto JsonView::size() const -> int
+    {
+        while (indexNext())
+        {
+        }
+
+        return static_cast<int> (numMembers);
+    }
+
+    auto JsonView::getKey (int index) const -> std::string_view
+    {
+        return (*this)[index].exists() ? getMember (static_cast<size_t> (index)).key : std::string_view();
+    }
+
+    auto JsonView::toString (std::string fallback) const -> std::string
+    {
+        JsonReader reader (text);
+        std::string value;
+        return reader.read (value) ? value : fallback;
+    }
+
+    auto JsonView::toDouble (double fallback) const -> double
+    {
+        JsonReader reader (text);
+        double value;
+        return reader.read (value) ? value : fallback;
+    }
+
+    auto JsonView::toInt64 (juce::int64 fallback) const -> juce::int64
+    {
+        JsonReader reader (text);
+        juce::int64 value;
+        return reader.read (value) ? value : fallback;
+    }
+
+    auto JsonView::toBool (bool fallback) const -> bool
+    {
+        JsonReader reader (text);
+        bool value;
+        return reader.read (value) ? value : fallback;
+    }
+
+    auto JsonView::toRawString() const -> std::string_view
+    {
+        JsonReader reader (text);
+        std::string_view raw;
+
+        if (reader.peek() != Type::string || ! reader.readRaw (raw))
+            return {};
+
+        return raw.substr (1, raw.size() - 2);
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "JsonReader.h"
+#include <array>
+#include <vector>
+
+namespace db {
+
+    /** A lazy, read-only view of a JSON value that points into text owned by someone else, typically the
+        json blob of a revision still sitting in sqlite's column buffer.
+
+        Nothing is parsed up front. Lookups in an object or array index its direct members (where each one
+        starts and ends, without decoding any of them) only as far as the one asked for, picking up where
+        the last lookup stopped. Values are only decoded when one of the to...() accessors is called.
+
+        Looking up something that isn't there gives a view for which exists() is false and whose accessors
+        return their fallbacks, so lookups can be chained.
+    */
+    class JsonView
+    {
+    public:
+        using Type = JsonReader::Type;
+
+        JsonView() = default;
+        explicit JsonView (std::string_view json);
+
+        /** Type of the value, or Type::invalid if it is missing or malformed. */
+        auto getType() const -> Type;
+
+        auto exists() const -> bool   { return getType() != Type::invalid; }
+        auto isNull() const -> bool   { return getType() == Type::null; }
+        auto isObject() const -> bool { return getType() == Type::object; }
+        auto isArray() const -> bool  { return getType() == Type::array; }
+
+        /** A member of an object, by its key as it is written (escapes aren't decoded). */
+        auto operator[] (std::string_view key) const -> JsonView;
+
+        /** The index'th member of an object or element of an array. */
+        auto operator[] (int index) const -> JsonView;
+
+        /** Number of members of an object or elements of an array, 0 for anything else. */
+        auto size() const -> int;
+
+        /** Key of the index'th member of an object, as it is written. */
+        auto getKey (int index) const -> std::string_view;
+
+        auto toString (std::string fallback = {}) const -> std::string;
+        auto toDouble (double fallback = 0.0) const -> double;
+        auto toInt64 (juce::int64 fallback = 0) const -> juce::int64;
+        auto toBool (bool fallback = false) const -> bool;
+
+        /** The text of a string between its quotes, with escapes left as they are. */
+        auto toRawString() const -> std::string_view;
+
+        /** The value's text as it is written. */
+        auto getRaw() const -> std::string_view { return text; }
+
+    private:
+        struct Member
+        {
+            std::string_view key;   // empty for array elements
+            std::string_view value;
+        };
+
+        enum class Indexing
+        {
+            notStarted,
+            object,
+            array,
+            done
+        };
+
+        /** Indexes one more member, returning false once there are no more. */
+        auto indexNext() const -> bool;
+        auto getMember (size_t index) const -> const Member&;
+
+        std::string_view text;
+
+        // The first few members are kept inline, so looking up a key near the start doesn't allocate
+        mutable std::array<Member, 8> firstMembers;
+        mutable std::vector<Member> moreMembers;
+        mutable size_t numMembers = 0;
+        mutable JsonReader scanner { std::string_view() };
+        mutable Indexing indexing = Indexing::notStarted;
+    };
+}
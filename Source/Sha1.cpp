@@ -0,0 +1,221 @@
+#include "Sha1.h"
+#include <cstring>
+#include <utility>
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+ #define DB_SHA1_X86 1
+ #include <immintrin.h>
+ #if defined (_MSC_VER)
+  #include <intrin.h>
+ #else
+  #include <cpuid.h>
+ #endif
+#else
+ #define DB_SHA1_X86 0
+#endif
+
+namespace db {
+
+    namespace {
+
+        constexpr size_t blockSize = 64;
+        using State = std::array<uint32_t, 5>;
+
+        auto rotateLeft (uint32_t value, int bits) -> uint32_t
+        {
+            return (value << bits) | (value >> (32 - bits));
+        }
+
+        auto readBigEndian (const uint8_t* bytes) -> uint32_t
+        {
+            return (static_cast<uint32_t> (bytes[0]) << 24) | (static_cast<uint32_t> (bytes[1]) << 16)
+                 | (static_cast<uint32_t> (bytes[2]) << 8)  |  static_cast<uint32_t> (bytes[3]);
+        }
+
+        auto processBlocksPortable (State& state, const uint8_t* data, size_t numBlocks) -> void
+        {
+            for (; numBlocks > 0; --numBlocks, data += blockSize)
+            {
+                // The message schedule only ever looks 16 words back, so it is kept in a ring
+                std::array<uint32_t, 16> w;
+                for (size_t i = 0; i < 16; ++i)
+                    w[i] = readBigEndian (data + i * 4);
+
+                auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+                for (size_t t = 0; t < 80; ++t)
+                {
+                    if (t >= 16)
+                        w[t & 15] = rotateLeft (w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+
+                    uint32_t f, k;
+                    if (t < 20)      { f = (b & c) | (~b & d);           k = 0x5a827999; }
+                    else if (t < 40) { f = b ^ c ^ d;                    k = 0x6ed9eba1; }
+                    else if (t < 60) { f = (b & c) | (b & d) | (c & d);  k = 0x8f1bbcdc; }
+                    else             { f = b ^ c ^ d;                    k = 0xca62c1d6; }
+
+                    const auto temp = rotateLeft (a, 5) + f + e + k + w[t & 15];
+                    e = d;
+                    d = c;
+                    c = rotateLeft (b, 30);
+                    b = a;
+                    a = temp;
+                }
+
+                state[0] += a;
+                state[1] += b;
+                state[2] += c;
+                state[3] += d;
+                state[4] += e;
+            }
+        }
+
+       #if DB_SHA1_X86
+        auto detectShaExtensions() -> bool
+        {
+            // SSSE3 (leaf 1 ecx bit 9), SSE4.1 (leaf 1 ecx bit 19) and SHA (leaf 7 ebx bit 29)
+           #if defined (_MSC_VER)
+            int info[4] = {};
+            __cpuid (info, 0);
+            if (info[0] < 7)
+                return false;
+
+            __cpuid (info, 1);
+            const auto ecx = static_cast<unsigned int> (info[2]);
+            __cpuidex (info, 7, 0);
+            const auto ebx = static_cast<unsigned int> (info[1]);
+           #else
+            unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if (__get_cpuid_max (0, nullptr) < 7 || ! __get_cpuid (1, &eax, &ebx, &ecx, &edx))
+                return false;
+
+            const auto leaf1Ecx = ecx;
+            __cpuid_count (7, 0, eax, ebx, ecx, edx);
+            ecx = leaf1Ecx;
+           #endif
+
+            return (ecx & (1u << 9)) != 0 && (ecx & (1u << 19)) != 0 && (ebx & (1u << 29)) != 0;
+        }
+
+        #if defined (__GNUC__) || defined (__clang__)
+         #define DB_SHA1_TARGET __attribute__ ((target ("sha,ssse3,sse4.1")))
+        #else
+         #define DB_SHA1_TARGET
+        #endif
+
+        /** Four rounds with the next four message words, which come from the four before them. The group
+            is a template argument so that the message ring and the round function resolve to registers
+            and immediates. */
+        template <int group>
+        DB_SHA1_TARGET inline auto shaRounds (__m128i& abcd, __m128i& e, __m128i& previousAbcd, __m128i (&message)[4]) -> void
+        {
+            auto& words = message[group & 3];
+
+            if constexpr (group >= 4)
+                words = _mm_sha1msg2_epu32 (_mm_xor_si128 (_mm_sha1msg1_epu32 (words, message[(group + 1) & 3]), message[(group + 2) & 3]),
+                                            message[(group + 3) & 3]);
+
+            if constexpr (group == 0)
+                e = _mm_add_epi32 (e, words);
+            else
+                e = _mm_sha1nexte_epu32 (previousAbcd, words);
+
+            previousAbcd = abcd;
+            abcd = _mm_sha1rnds4_epu32 (abcd, e, group / 5);
+        }
+
+        template <int... groups>
+        DB_SHA1_TARGET inline auto shaBlockRounds (__m128i& abcd, __m128i& e, __m128i& previousAbcd, __m128i (&message)[4],
+                                                   std::integer_sequence<int, groups...>) -> void
+        {
+            (shaRounds<groups> (abcd, e, previousAbcd, message), ...);
+        }
+
+        DB_SHA1_TARGET auto processBlocksSha (State& state, const uint8_t* data, size_t numBlocks) -> void
+        {
+            const auto byteSwap = _mm_set_epi64x (0x0001020304050607ll, 0x08090a0b0c0d0e0fll);
+
+            auto abcd = _mm_shuffle_epi32 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (state.data())), 0x1b);
+            auto e0 = _mm_set_epi32 (static_cast<int> (state[4]), 0, 0, 0);
+
+            for (; numBlocks > 0; --numBlocks, data += blockSize)
+            {
+                const auto abcdBefore = abcd;
+                const auto eBefore = e0;
+
+                __m128i message[4];
+                for (int i = 0; i < 4; ++i)
+                    message[i] = _mm_shuffle_epi8 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (data + i * 16)), byteSwap);
+
+                auto e = e0;
+                auto previousAbcd = abcd;
+                shaBlockRounds (abcd, e, previousAbcd, message, std::make_integer_sequence<int, 20>());
+
+                e0 = _mm_sha1nexte_epu32 (previousAbcd, eBefore);
+                abcd = _mm_add_epi32 (abcd, abcdBefore);
+            }
+
+            _mm_storeu_si128 (reinterpret_cast<__m128i*> (state.data()), _mm_shuffle_epi32 (abcd, 0x1b));
+            state[4] = static_cast<uint32_t> (_mm_extract_epi32 (e0, 3));
+        }
+
+        #undef DB_SHA1_TARGET
+       #endif
+
+        auto processBlocks (State& state, const uint8_t* data, size_t numBlocks) -> void
+        {
+           #if DB_SHA1_X86
+            if (hasHardwareSha1())
+                return processBlocksSha (state, data, numBlocks);
+           #endif
+
+            processBlocksPortable (state, data, numBlocks);
+        }
+    }
+
+    auto hasHardwareSha1() -> bool
+    {
+       #if DB_SHA1_X86
+        static const bool hasShaExtensions = detectShaExtensions();
+        return hasShaExtensions;
+       #else
+        return false;
+       #endif
+    }
+
+    auto computeSha1 (std::span<const std::byte> data) -> Sha1Digest
+    {
+        State state { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+        const auto bytes = reinterpret_cast<const uint8_t*> (data.data());
+        const auto fullBlocks = data.size() / blockSize;
+        processBlocks (state, bytes, fullBlocks);
+
+        // The rest of the data, a 1 bit, zeros and the length in bits take up one or two more blocks
+        std::array<uint8_t, blockSize * 2> tail {};
+        const auto rest = data.size() - fullBlocks * blockSize;
+        if (rest > 0)
+            std::memcpy (tail.data(), bytes + fullBlocks * blockSize, rest);
+
+        tail[rest] = 0x80;
+        const auto tailSize = rest + 9 <= blockSize ? blockSize : blockSize * 2;
+        const auto bitLength = static_cast<uint64_t> (data.size()) * 8;
+
+        for (size_t i = 0; i < 8; ++i)
+            tail[tailSize - 1 - i] = static_cast<uint8_t> (bitLength >> (i * 8));
+
+        processBlocks (state, tail.data(), tailSize / blockSize);
+
+        Sha1Digest digest;
+        for (size_t i = 0; i < state.size(); ++i)
+            for (size_t j = 0; j < 4; ++j)
+                digest[i * 4 + j] = static_cast<uint8_t> (state[i] >> (24 - j * 8));
+
+        return digest;
+    }
+
+    auto getAttachmentDigest (const Sha1Digest& sha1) -> std::string
+    {
+        return "sha1-" + juce::Base64::toBase64 (sha1.data(), sha1.size()).toStdString();
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <JuceHeader.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace db {
+
+    using Sha1Digest = std::array<uint8_t, 20>;
+
+    /** The SHA-1 of a block of memory, using the CPU's SHA extensions when it has them (most x86 chips
+        since Goldmont and Zen) and a portable implementation otherwise. */
+    auto computeSha1 (std::span<const std::byte> data) -> Sha1Digest;
+
+    /** True if computeSha1 runs on the SHA extensions. */
+    auto hasHardwareSha1() -> bool;
+
+    /** The digest as Couchbase Lite writes it into a document's _attachments: "sha1-<base64>". */
+    auto getAttachmentDigest (const Sha1Digest& sha1) -> std::string;
+}
@@ -1,3 +1,9 @@
+// Full-text search and R*Tree spatial indexes for views (ViewEmitter::emitText and
+// emitBoundingBox). These only apply where the amalgamation is compiled in; the Mac build links
+// the system sqlite3, which may lack either, so CouchbaseLiteDatabase checks at run time.
+#define SQLITE_ENABLE_FTS5 1
+#define SQLITE_ENABLE_RTREE 1
+
 #ifdef _WIN32
     #include "sqlite3.c"
 #endif
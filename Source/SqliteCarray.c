@@ -0,0 +1,6 @@
+// Builds the vendored carray table-valued function straight into the app, so it can be
+// registered on our connection with sqlite3_carray_init instead of being loaded as an extension.
+// carray.h comes first so that carray.c takes its CARRAY_* flags from the same header the app binds with.
+#define SQLITE_CORE 1
+#include "carray.h"
+#include "carray.c"
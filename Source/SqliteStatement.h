@@ -0,0 +1,137 @@
+#pragma once
+#include <sqlite3.h>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace db {
+
+    /** Owns a raw sqlite3_stmt for the few places where sqlite_modern_cpp doesn't give us enough control,
+        e.g. binding pointers for table-valued functions or stepping one row at a time.
+        Errors are thrown as std::runtime_error carrying sqlite's message. */
+    struct Statement
+    {
+        Statement (sqlite3* connection, std::string_view sql) : stmt (nullptr, &sqlite3_finalize)
+        {
+            sqlite3_stmt* prepared = nullptr;
+            check (connection, sqlite3_prepare_v2 (connection, sql.data(), static_cast<int> (sql.size()), &prepared, nullptr));
+            stmt.reset (prepared);
+        }
+
+        auto get() const -> sqlite3_stmt* { return stmt.get(); }
+
+        /** Returns true while there is a row to read and false once the statement is done. */
+        auto step() -> bool
+        {
+            const int result = sqlite3_step (stmt.get());
+            if (result == SQLITE_ROW)
+                return true;
+            if (result != SQLITE_DONE)
+                check (sqlite3_db_handle (stmt.get()), result);
+            return false;
+        }
+
+        auto bind (int index, std::string_view text) -> Statement&
+        {
+            check (sqlite3_db_handle (stmt.get()), sqlite3_bind_text (stmt.get(), index, text.data(), static_cast<int> (text.size()), SQLITE_TRANSIENT));
+            return *this;
+        }
+
+        auto bind (int index, sqlite3_int64 value) -> Statement&
+        {
+            check (sqlite3_db_handle (stmt.get()), sqlite3_bind_int64 (stmt.get(), index, value));
+            return *this;
+        }
+
+        auto bind (int index, double value) -> Statement&
+        {
+            check (sqlite3_db_handle (stmt.get()), sqlite3_bind_double (stmt.get(), index, value));
+            return *this;
+        }
+
+        auto bindBlob (int index, const void* data, int size) -> Statement&
+        {
+            check (sqlite3_db_handle (stmt.get()), sqlite3_bind_blob (stmt.get(), index, data, size, SQLITE_TRANSIENT));
+            return *this;
+        }
+
+        auto bindNull (int index) -> Statement&
+        {
+            check (sqlite3_db_handle (stmt.get()), sqlite3_bind_null (stmt.get(), index));
+            return *this;
+        }
+
+        auto getInt64 (int column) const -> sqlite3_int64 { return sqlite3_column_int64 (stmt.get(), column); }
+        auto getDouble (int column) const -> double       { return sqlite3_column_double (stmt.get(), column); }
+        auto getType (int column) const -> int            { return sqlite3_column_type (stmt.get(), column); }
+        auto isNull (int column) const -> bool            { return getType (column) == SQLITE_NULL; }
+
+        /** Text columns are returned as views into sqlite's buffer, valid until the next step(). Use getBlob()
+            for binary data: reading a blob as text converts it, adding a terminator. */
+        auto getText (int column) const -> std::string_view
+        {
+            auto text = reinterpret_cast<const char*> (sqlite3_column_text (stmt.get(), column));
+            return { text != nullptr ? text : "", static_cast<size_t> (sqlite3_column_bytes (stmt.get(), column)) };
+        }
+
+        /** A blob column's bytes, valid until the next step(). Empty for NULL or a zero-length blob. */
+        auto getBlob (int column) const -> std::span<const std::byte>
+        {
+            auto blob = static_cast<const std::byte*> (sqlite3_column_blob (stmt.get(), column));
+            return { blob, blob != nullptr ? static_cast<size_t> (sqlite3_column_bytes (stmt.get(), column)) : 0 };
+        }
+
+        /** Rewinds the statement so it can be run again; the bindings are kept. */
+        auto reset() -> void
+        {
+            sqlite3_reset (stmt.get());
+        }
+
+        static void check (sqlite3* connection, int result)
+        {
+            if (result != SQLITE_OK)
+                throw std::runtime_error (std::string ("SQLite error: ") + sqlite3_errmsg (connection));
+        }
+
+    private:
+        std::unique_ptr<sqlite3_stmt, decltype (&sqlite3_finalize)> stmt;
+    };
+
+    /** A write transaction for as long as it lives: commit() makes it stick, and it is rolled back if it
+        goes out of scope without that, e.g. because something threw. It starts IMMEDIATE so that the write
+        lock is taken up front instead of failing with SQLITE_BUSY halfway through. */
+    struct Transaction
+    {
+        explicit Transaction (sqlite3* db) : connection (db)
+        {
+            execute ("BEGIN IMMEDIATE");
+        }
+
+        ~Transaction()
+        {
+            if (! committed)
+                sqlite3_exec (connection, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+
+        auto commit() -> void
+        {
+            execute ("COMMIT");
+            committed = true;
+        }
+
+        Transaction (const Transaction&) = delete;
+        Transaction& operator= (const Transaction&) = delete;
+
+    private:
+        auto execute (const char* sql) -> void
+        {
+            Statement::check (connection, sqlite3_exec (connection, sql, nullptr, nullptr, nullptr));
+        }
+
+        sqlite3* connection;
+        bool committed = false;
+    };
+}
@@ -0,0 +1,163 @@
+#include "StatementCache.h"
+
+namespace db {
+
+    // A database_binder executes itself on destruction unless it has been used,
+    // which is never what we want for a statement that is only being put away.
+    static void putAway (sqlite::database_binder& statement)
+    {
+        try
+        {
+            statement.reset();
+        }
+        catch (...)
+        {
+        }
+        statement.used (true);
+    }
+
+    // Resetting ends the read the statement may still have open, and clearing the bindings lets go of
+    // anything bound with SQLITE_STATIC, such as the arrays handed to carray.
+    static void putAway (Statement& statement)
+    {
+        statement.reset();
+        sqlite3_clear_bindings (statement.get());
+    }
+
+    StatementCache::Lease::Lease (sqlite::database_binder& s, bool* flag, std::unique_ptr<sqlite::database_binder> owned)
+        : statement (&s), inUse (flag), uncached (std::move (owned))
+    {
+    }
+
+    StatementCache::Lease::Lease (Lease&& other) noexcept
+        : statement (other.statement), inUse (other.inUse), uncached (std::move (other.uncached))
+    {
+        other.statement = nullptr;
+        other.inUse = nullptr;
+    }
+
+    StatementCache::Lease::~Lease()
+    {
+        if (statement == nullptr)
+            return;
+
+        putAway (*statement);
+
+        if (inUse != nullptr)
+            *inUse = false;
+    }
+
+    StatementCache::StatementLease::StatementLease (Statement& s, bool* flag, std::unique_ptr<Statement> owned)
+        : statement (&s), inUse (flag), uncached (std::move (owned))
+    {
+    }
+
+    StatementCache::StatementLease::StatementLease (StatementLease&& other) noexcept
+        : statement (other.statement), inUse (other.inUse), uncached (std::move (other.uncached))
+    {
+        other.statement = nullptr;
+        other.inUse = nullptr;
+    }
+
+    StatementCache::StatementLease::~StatementLease()
+    {
+        if (statement == nullptr)
+            return;
+
+        putAway (*statement);
+
+        if (inUse != nullptr)
+            *inUse = false;
+    }
+
+    StatementCache::StatementCache (sqlite::database& db) : database (db)
+    {
+    }
+
+    StatementCache::~StatementCache()
+    {
+        clear();
+    }
+
+    auto StatementCache::prepare (std::string_view sql) -> std::unique_ptr<sqlite::database_binder>
+    {
+        const auto start = juce::Time::getHighResolutionTicks();
+        auto statement = std::make_unique<sqlite::database_binder> (database << std::string (sql));
+        stats.prepareMilliseconds += 1000.0 * juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - start);
+        ++stats.misses;
+        return statement;
+    }
+
+    auto StatementCache::prepareStatement (std::string_view sql) -> std::unique_ptr<Statement>
+    {
+        const auto start = juce::Time::getHighResolutionTicks();
+        auto statement = std::make_unique<Statement> (database.connection().get(), sql);
+        stats.prepareMilliseconds += 1000.0 * juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - start);
+        ++stats.misses;
+        return statement;
+    }
+
+    auto StatementCache::acquire (std::string_view sql) -> Lease
+    {
+        auto found = entries.find (sql);
+
+        if (found == entries.end())
+        {
+            found = entries.emplace (std::string (sql), Entry { prepare (sql) }).first;
+        }
+        else if (found->second.inUse)
+        {
+            auto statement = prepare (sql);
+            auto& binder = *statement;
+            return { binder, nullptr, std::move (statement) };
+        }
+        else
+        {
+            ++stats.hits;
+        }
+
+        auto& entry = found->second;
+        entry.inUse = true;
+        return { *entry.statement, &entry.inUse, nullptr };
+    }
+
+    auto StatementCache::acquireStatement (std::string_view sql) -> StatementLease
+    {
+        auto found = statementEntries.find (sql);
+
+        if (found == statementEntries.end())
+        {
+            found = statementEntries.emplace (std::string (sql), StatementEntry { prepareStatement (sql) }).first;
+        }
+        else if (found->second.inUse)
+        {
+            auto statement = prepareStatement (sql);
+            auto& raw = *statement;
+            return { raw, nullptr, std::move (statement) };
+        }
+        else
+        {
+            ++stats.hits;
+        }
+
+        auto& entry = found->second;
+        entry.inUse = true;
+        return { *entry.statement, &entry.inUse, nullptr };
+    }
+
+    void StatementCache::clear()
+    {
+        for (auto& [sql, entry] : entries)
+        {
+            jassert (!entry.inUse);
+            putAway (*entry.statement);
+        }
+
+        entries.clear();
+
+        for (auto& [sql, entry] : statementEntries)
+            jassert (!entry.inUse);
+
+        statementEntries.clear();
+    }
+}
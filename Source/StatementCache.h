@@ -0,0 +1,106 @@
+#pragma once
+#include <JuceHeader.h>
+#include <sqlite_modern_cpp.h>
+#include "SqliteStatement.h"
+#include <string_view>
+#include <unordered_map>
+
+namespace db {
+
+    /** Keeps the prepared statements of one connection around, keyed by their SQL, so that hot accessors
+        don't pay for parsing and planning the query on every call.
+
+        acquire() hands out a Lease; when the lease goes away the statement is reset, its bindings are
+        cleared and it goes back into the cache. If the same query is already leased out (e.g. run again
+        from inside its own row callback) a fresh, uncached statement is prepared instead.
+        acquireStatement() does the same for a raw Statement, for queries that are stepped a row at a time.
+    */
+    class StatementCache
+    {
+    public:
+        struct Stats
+        {
+            juce::int64 hits = 0;
+            juce::int64 misses = 0;
+            double prepareMilliseconds = 0.0;
+        };
+
+        class Lease
+        {
+        public:
+            Lease (Lease&& other) noexcept;
+            Lease& operator= (Lease&&) = delete;
+            ~Lease();
+
+            auto operator*() const -> sqlite::database_binder&  { return *statement; }
+            auto operator->() const -> sqlite::database_binder* { return statement; }
+
+        private:
+            friend class StatementCache;
+            Lease (sqlite::database_binder& statement, bool* inUse, std::unique_ptr<sqlite::database_binder> uncached);
+
+            sqlite::database_binder* statement;
+            bool* inUse;
+            std::unique_ptr<sqlite::database_binder> uncached;
+        };
+
+        class StatementLease
+        {
+        public:
+            StatementLease (StatementLease&& other) noexcept;
+            StatementLease& operator= (StatementLease&&) = delete;
+            ~StatementLease();
+
+            auto operator*() const -> Statement&  { return *statement; }
+            auto operator->() const -> Statement* { return statement; }
+
+        private:
+            friend class StatementCache;
+            StatementLease (Statement& statement, bool* inUse, std::unique_ptr<Statement> uncached);
+
+            Statement* statement;
+            bool* inUse;
+            std::unique_ptr<Statement> uncached;
+        };
+
+        explicit StatementCache (sqlite::database& database);
+        ~StatementCache();
+
+        auto acquire (std::string_view sql) -> Lease;
+        auto acquireStatement (std::string_view sql) -> StatementLease;
+
+        /** Finalizes every cached statement, e.g. before the schema is changed underneath them. */
+        void clear();
+
+        auto getStats() const -> Stats { return stats; }
+
+    private:
+        struct Entry
+        {
+            std::unique_ptr<sqlite::database_binder> statement;
+            bool inUse = false;
+        };
+
+        struct StatementEntry
+        {
+            std::unique_ptr<Statement> statement;
+            bool inUse = false;
+        };
+
+        struct Hash
+        {
+            using is_transparent = void;
+            auto operator() (std::string_view sql) const noexcept -> size_t { return std::hash<std::string_view>() (sql); }
+        };
+
+        auto prepare (std::string_view sql) -> std::unique_ptr<sqlite::database_binder>;
+        auto prepareStatement (std::string_view sql) -> std::unique_ptr<Statement>;
+
+        sqlite::database& database;
+        std::unordered_map<std::string, Entry, Hash, std::equal_to<>> entries;
+        std::unordered_map<std::string, StatementEntry, Hash, std::equal_to<>> statementEntries;
+        Stats stats;
+
+        JUCE_DECLARE_NON_COPYABLE (StatementCache)
+    };
+}
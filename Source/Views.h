@@ -0,0 +1,190 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SqliteStatement.h"
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace db {
+
+    /** Collects what a map function emits for one document. Keys and values are stored as JSON text,
+        the form they take in the maps_N tables. */
+    class ViewEmitter
+    {
+    public:
+        struct Row
+        {
+            juce::String key;
+            juce::String value;     // empty for a null value
+            juce::String text;      // only set for full-text rows
+            std::optional<juce::Rectangle<double>> bounds;  // only set for spatial rows
+        };
+
+        /** Adds a row to the view for the document being mapped. */
+        void emit (const juce::var& key, const juce::var& value = {});
+
+        /** Adds a full-text row: the text goes into the view's FTS5 index, where searchText finds it, and
+            the row itself gets a null key. */
+        void emitText (const juce::String& text, const juce::var& value = {});
+
+        /** Adds a spatial row: the box (or point, if it is empty) goes into the view's R*Tree index, where
+            queryBoundingBox finds it, and the row itself gets a null key. Any two numbers work as the axes,
+            e.g. a riff's creation time and its BPM. */
+        void emitBoundingBox (juce::Rectangle<double> bounds, const juce::var& value = {});
+
+        auto getRows() const -> const std::vector<Row>& { return rows; }
+        void clear() { rows.clear(); }
+
+    private:
+        std::vector<Row> rows;
+    };
+
+    /** Called with the winning revision of every live, non-design document (as getDocument returns it)
+        to emit that document's rows. It must only depend on the document, as it is only called again when
+        the document changes, or when the view's version does. */
+    using MapFunction = std::function<void (const juce::var& document, ViewEmitter& emitter)>;
+
+    /** A row of a spatial view, as queryBoundingBox returns it. */
+    struct SpatialRow
+    {
+        juce::String docId;
+        juce::Rectangle<double> bounds;
+        juce::var value;
+    };
+
+    /** What one updateView call did. */
+    struct ViewUpdateStats
+    {
+        juce::int64 documentsMapped = 0;
+        juce::int64 rowsEmitted = 0;
+        juce::int64 rowsDeleted = 0;
+        juce::int64 lastSequence = 0;
+        int threads = 1;
+        double seconds = 0.0;
+
+        auto getRowsPerSecond() const -> double { return seconds > 0.0 ? static_cast<double> (rowsEmitted) / seconds : 0.0; }
+    };
+
+    /** What queryView returns, in CouchDB's terms. */
+    struct ViewQueryOptions
+    {
+        enum class Reducer
+        {
+            none,
+            count,      // _count: number of rows
+            sum,        // _sum: sum of the numeric values
+            stats       // _stats: { sum, count, min, max, sumsqr } of the numeric values
+        };
+
+        /** First and last key of the range, compared with the JSON collation. With descending, startKey is
+            the high end. Left empty, the range is open on that side. */
+        std::optional<juce::var> startKey;
+        std::optional<juce::var> endKey;
+        bool inclusiveEnd = true;
+        bool descending = false;
+
+        /** Only rows with one of these keys, in this order. The range is ignored when this is set. */
+        juce::Array<juce::var> keys;
+
+        /** Rows (or groups, when reducing) to leave out at the start and the most to return, -1 for all. */
+        int skip = 0;
+        int limit = -1;
+
+        /** With a reducer, rows are combined into one per group: everything (group false and groupLevel 0),
+            each distinct key (group), or each distinct first groupLevel elements of array keys. */
+        Reducer reduce = Reducer::none;
+        bool group = false;
+        int groupLevel = 0;
+
+        /** Answers a reduced query from the view's reduce cache, which holds every group at this level and
+            is kept current by updateView. The first such query builds it with one pass over the view, and
+            after that each update pays a little to maintain it. Only for views registered here; ignored
+            with keys. */
+        bool cached = false;
+
+        /** Queries a registered view without bringing it up to date first. */
+        bool stale = false;
+    };
+
+    /** What a reducer has folded into one group: every row counts, the rest only covers numeric values. */
+    struct ReduceTotals
+    {
+        juce::int64 count = 0;
+        double sum = 0.0;
+        double sumOfSquares = 0.0;
+        double min = 0.0;
+        double max = 0.0;
+        bool hasNumbers = false;
+    };
+
+    /** Streams the rows of a view query, reading them off sqlite one at a time as next() is called.
+
+        Like DocumentView it holds on to a statement, and with it a read transaction, for as long as it
+        lives, so don't keep one around after you are done with it.
+    */
+    class ViewCursor
+    {
+    public:
+        ViewCursor() = default;
+
+        /** Moves to the next row, returning false once there are no more. */
+        auto next() -> bool;
+
+        /** The current row's key and value. A map row's value is null if nothing was emitted for it. */
+        auto getKey() const -> juce::var;
+        auto getValue() const -> juce::var;
+
+        /** The emitting document's ID, or empty for a reduced row. */
+        auto getDocId() const -> juce::String;
+
+        /** The key as JSON text, valid until the next call to next(). */
+        auto getKeyJson() const -> std::string_view { return key; }
+
+    private:
+        friend struct CouchbaseLiteDatabase;
+        using ReducedRows = std::vector<std::pair<std::string, juce::var>>;
+
+        ViewCursor (std::unique_ptr<Statement> rangeOrKeyStatement, const ViewQueryOptions& options);
+        ViewCursor (ReducedRows rows, const ViewQueryOptions& options);
+
+        /** Steps to the next map row, moving on to the next of the keys when one runs out. */
+        auto stepRow() -> bool;
+        auto readRow() -> void;
+        auto nextReduced() -> bool;
+        auto nextCachedRow() -> bool;
+        auto isInGroup (std::string_view rowKey) const -> bool;
+
+        std::unique_ptr<Statement> statement;
+        std::vector<std::string> keys;
+        size_t nextKey = 0;
+        ViewQueryOptions::Reducer reduce = ViewQueryOptions::Reducer::none;
+        int groupLevel = 0;         // -1 to group by whole keys
+        int toSkip = 0;
+        int remaining = -1;
+
+        std::string_view key, value, docId;
+        std::string groupKey;
+        juce::var reducedValue;
+        ReduceTotals totals;   // of the current reduced row, unless it came from the cache
+        ReducedRows cachedRows;
+        size_t cachedRow = 0;
+        bool rowPending = false;   // the statement is on the first row of the next group
+        bool sourceDone = false;
+    };
+
+    /** CREATE TABLE statement for the maps table of the view with the given view_id. */
+    auto getViewTableCreate (const int id) -> juce::String;
+
+    /** Sets up the TEMP triggers that keep a view's full-text index and R*Tree in step with its maps table
+        on this connection, first clearing out rows orphaned while there were none. Does nothing for a
+        view that has neither yet. */
+    auto createViewTriggers (sqlite3* connection, int id) -> void;
+
+    /** Whether the connection's sqlite has FTS5, which views that emit text need. The Windows build
+        compiles it into the amalgamation; the Mac build links the system's sqlite, which may lack it. */
+    auto hasFullTextModule (sqlite3* connection) -> bool;
+
+    /** The same for the R*Tree module, which views that emit bounding boxes need. */
+    auto hasRTreeModule (sqlite3* connection) -> bool;
+}
@@ -0,0 +1,161 @@
+#include <JuceHeader.h>
+#include "../Source/Collation.h"
+#include <string>
+#include <vector>
+
+namespace db {
+
+    /** Checks the collations against lists of keys written down in the order they should sort. Every pair
+        in a list is compared both ways, so a collation that isn't antisymmetric fails too. */
+    class CollationTests : public juce::UnitTest
+    {
+    public:
+        CollationTests() : juce::UnitTest ("Collations", "Collation") {}
+
+        void runTest() override
+        {
+            beginTest ("JSON orders null < false < true < numbers < strings < arrays < objects");
+            expectOrdered (collateJSON, { "null", "false", "true", "0", "\"\"", "[]", "{}" });
+
+            beginTest ("JSON compares numbers by value");
+            expectOrdered (collateJSON, { "-1e3", "-10", "-1", "-0.5", "0", "1e-3", "0.5", "1", "2", "10", "1e3",
+                                          "12345678901234567890", "1e20", "1.5e20" });
+            expectSame (collateJSON, "1", "1.0");
+            expectSame (collateJSON, "1", "1e0");
+            expectSame (collateJSON, "100", "1E2");
+            expectSame (collateJSON, "0", "-0");
+
+            beginTest ("JSON compares arrays and objects element by element");
+            expectOrdered (collateJSON, { "[]", "[null]", "[1]", "[1,2]", "[1,\"a\"]", "[2]", "[\"a\"]", "[[]]" });
+            expectOrdered (collateJSON, { "{}", "{\"a\":1}", "{\"a\":1,\"b\":2}", "{\"a\":2}", "{\"b\":1}" });
+            expectSame (collateJSON, "[1, {\"a\" : [true]}]", "[1,{\"a\":[true]}]");
+
+            beginTest ("JSON sorts accented letters with their base letter, then by accent, then by case");
+            expectOrdered (collateJSON, { "\"\"", "\"a\"", "\"A\"", "\"aa\"", "\"ab\"", "\"b\"", "\"B\"" });
+            expectOrdered (collateJSON, { "\"e\"", "\"E\"", "\"\xc3\xa9\"", "\"\xc3\x89\"", "\"f\"" });
+            expectOrdered (collateJSON, { "\"cote\"", "\"cot\xc3\xa9\"", "\"c\xc3\xb4te\"" });
+            expectOrdered (collateJSON, { "\"ab\"", "\"ae\"", "\"\xc3\xa6\"", "\"\xc3\xa6""a\"", "\"af\"" });
+            expectOrdered (collateJSON, { "\"o\"", "\"\xc3\xb8\"", "\"p\"" });
+            expectOrdered (collateJSON, { "\"ss\"", "\"\xc3\x9f\"", "\"st\"" });
+
+            beginTest ("JSON decodes escapes before comparing strings");
+            expectSame (collateJSON, "\"\\u00e9\"", "\"\xc3\xa9\"");
+            expectSame (collateJSON, "\"a\\/b\"", "\"a/b\"");
+            expectSame (collateJSON, "\"\\ud83d\\ude00\"", "\"\xf0\x9f\x98\x80\"");
+            expectOrdered (collateJSON, { "\"a\"", "\"a\\\"b\"", "\"ab\"" });
+            expectSame (collateJSON, "\"\\u0041\"", "\"A\"");
+
+            beginTest ("JSON_ASCII keeps JSON's type order but compares strings by code point");
+            expectOrdered (collateJSONAscii, { "null", "false", "true", "-1", "1e2", "\"\"", "[]", "{}" });
+            expectOrdered (collateJSONAscii, { "\"A\"", "\"B\"", "\"a\"", "\"b\"", "\"\xc3\xa6\"", "\"\xc3\xa9\"" });
+            expectOrdered (collateJSONAscii, { "\"cote\"", "\"cot\xc3\xa9\"", "\"c\xc3\xb4te\"" });
+            expectSame (collateJSONAscii, "\"\\u00e9\"", "\"\xc3\xa9\"");
+            expectSame (collateJSONAscii, "1", "1.0");
+
+            beginTest ("JSON_RAW orders numbers < false < null < true < objects < arrays < strings");
+            expectOrdered (collateJSONRaw, { "-1", "1", "false", "null", "true", "{}", "[]", "\"\"" });
+            expectOrdered (collateJSONRaw, { "[]", "[1]", "[1,2]", "[2]", "[false]" });
+
+            beginTest ("JSON_RAW compares the bytes of strings without decoding escapes");
+            expectOrdered (collateJSONRaw, { "\"A\"", "\"Z\"", "\"\\u00e9\"", "\"a\"", "\"\xc3\xa9\"" });
+            expectOrdered (collateJSONRaw, { "\"a\"", "\"a\\\"b\"", "\"ab\"" });
+            expectOrdered (collateJSONRaw, { "[\"a\\\\\",1]", "[\"a\\\\\",2]" });
+
+            beginTest ("REVID compares generations numerically, then suffixes");
+            expectOrdered (collateRevIDs, { "1-ffff", "2-0000", "2-000a", "9-a", "10-a", "10-b", "99-z", "100-a", "12345678-a" });
+            expectOrdered (collateRevIDs, { "3-b0b5c8d9e0f1a2b3c4d5e6f708192a3b4c5d6e7f", "3-c0b5c8d9e0f1a2b3c4d5e6f708192a3b4c5d6e7f",
+                                            "12-00b5c8d9e0f1a2b3c4d5e6f708192a3b4c5d6e7f" });
+
+            beginTest ("REVID compares anything that isn't a revision ID as bytes");
+            expectOrdered (collateRevIDs, { "", "-a", "1-a", "123456789-a", "2-a" });
+            expectOrdered (collateRevIDs, { "0-b", "1-a" });
+            expectOrdered (collateRevIDs, { "10-a", "1x-a" });
+            expectOrdered (collateRevIDs, { "1x-a", "2-a" });
+            expectOrdered (collateRevIDs, { "abc", "abd", "b" });
+            expectSame (collateRevIDs, "7-abc", "7-abc");
+
+            beginTest ("Every first-difference search agrees with the portable one");
+            for (const auto& [name, finder] : getMismatchFinders())
+                expectFinderAgrees (name, finder);
+
+            beginTest ("Strings differing past the vectorised blocks still compare right");
+            for (size_t offset = 0; offset < 100; ++offset)
+            {
+                const std::string plain (100, 'x');
+                auto later = plain, escaped = plain;
+                later[offset] = 'y';
+                escaped.replace (offset, 1, "\\u0079");
+
+                for (auto collate : { Collation (collateJSON), Collation (collateJSONAscii), Collation (collateJSONRaw) })
+                {
+                    expectOrdered (collate, { "\"" + plain + "\"", "\"" + later + "\"" });
+                    expectOrdered (collate, { "\"" + plain.substr (0, offset) + "\"", "\"" + plain + "\"" });
+                }
+
+                expectSame (collateJSON, "\"" + escaped + "\"", "\"" + later + "\"");
+                expectSame (collateJSONAscii, "\"" + escaped + "\"", "\"" + later + "\"");
+            }
+        }
+
+    private:
+        using Collation = int (*) (std::string_view, std::string_view);
+
+        static auto describe (std::string_view key) -> juce::String
+        {
+            return juce::String::fromUTF8 (key.data(), static_cast<int> (key.size()));
+        }
+
+        void expectOrdered (Collation collate, std::initializer_list<std::string_view> keys)
+        {
+            const std::vector<std::string_view> sorted (keys);
+
+            for (size_t i = 0; i < sorted.size(); ++i)
+            {
+                expect (collate (sorted[i], sorted[i]) == 0, describe (sorted[i]) + " equals itself");
+
+                for (size_t j = i + 1; j < sorted.size(); ++j)
+                {
+                    expect (collate (sorted[i], sorted[j]) < 0, describe (sorted[i]) + " < " + describe (sorted[j]));
+                    expect (collate (sorted[j], sorted[i]) > 0, describe (sorted[j]) + " > " + describe (sorted[i]));
+                }
+            }
+        }
+
+        /** Runs a finder over strings that differ, or hold a quote or backslash, at every offset of every
+            length up to a few blocks of the widest one, so each block size and the tails after it are hit. */
+        void expectFinderAgrees (const char* name, MismatchFinder finder)
+        {
+            int failures = 0;
+
+            for (size_t length = 0; length <= 100; ++length)
+            {
+                const std::string plain (length, 'x');
+                failures += finder (plain.data(), plain.data(), length) != length;
+
+                for (size_t offset = 0; offset < length; ++offset)
+                {
+                    for (const char stop : { 'y', '"', '\\' })
+                    {
+                        auto p = plain, q = plain;
+                        q[offset] = stop;
+
+                        if (stop != 'y')
+                            p[offset] = stop;
+
+                        failures += finder (p.data(), q.data(), length) != offset;
+                    }
+                }
+            }
+
+            expectEquals (failures, 0, juce::String (name) + " finds the first difference");
+        }
+
+        void expectSame (Collation collate, std::string_view key1, std::string_view key2)
+        {
+            expect (collate (key1, key2) == 0, describe (key1) + " == " + describe (key2));
+            expect (collate (key2, key1) == 0, describe (key2) + " == " + describe (key1));
+        }
+    };
+
+    static CollationTests collationTests;
+}
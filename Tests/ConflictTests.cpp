@@ -0,0 +1,147 @@
+#include <JuceHeader.h>
+#include "../Source/CouchbaseLite.h"
+#include "../Source/globaldb.h"
+
+namespace db {
+
+    /** Finds and resolves conflicts in a copy of the database the tool ships with (see RiffTests), which
+        has none of its own, so a few documents with branches are added first. */
+    class ConflictTests : public juce::UnitTest
+    {
+    public:
+        ConflictTests() : juce::UnitTest ("Conflicts", "Documents") {}
+
+        void runTest() override
+        {
+            const auto folder = juce::File::createTempFile ("cblite2");
+            expect (folder.createDirectory().wasOk());
+
+            databaseFile = folder.getChildFile ("db.sqlite3");
+            expect (databaseFile.replaceWithData (db_sqlite3, db_sqlite3Size));
+
+            addConflicts();
+
+            {
+                CouchbaseLiteDatabase database (databaseFile);
+                runOn (database);
+            }
+
+            folder.deleteRecursively();
+        }
+
+    private:
+        void runOn (CouchbaseLiteDatabase& database)
+        {
+            beginTest ("findConflicts lists the live leaves of each conflicted document, winner first");
+            const auto conflicts = database.findConflicts();
+            expectEquals (static_cast<int> (conflicts.size()), 2);
+
+            if (conflicts.size() != 2)
+                return;
+
+            expect (conflicts[0].docId == "conflict-1");
+            expect (conflicts[0].revIds == std::vector<std::string> { "2-cccc", "2-bbbb" });
+            expect (conflicts[1].docId == "conflict-2");
+            expect (conflicts[1].revIds == std::vector<std::string> { "3-aaaa", "2-ffff" });
+
+            beginTest ("The current revision is the winner findConflicts puts first");
+            expectEquals (database.getDocument ("conflict-1")["_rev"].toString(), juce::String ("2-cccc"));
+            expectEquals (database.getDocument ("conflict-2")["_rev"].toString(), juce::String ("3-aaaa"));
+
+            beginTest ("resolveConflicts closes every losing branch and leaves the winner alone");
+            {
+                expectEquals (database.resolveConflicts (conflicts), 2);
+                expect (database.findConflicts().empty());
+
+                const auto winner = database.getDocument ("conflict-1");
+                expectEquals (winner["_rev"].toString(), juce::String ("2-cccc"));
+                expectEquals (winner["side"].toString(), juce::String ("c"));
+                expectEquals (database.getDocument ("conflict-2")["_rev"].toString(), juce::String ("3-aaaa"));
+                expectEquals (database.getDocument ("no-conflict")["_rev"].toString(), juce::String ("2-a"));
+            }
+
+            beginTest ("The losing leaf gets a deleted child of the next generation");
+            {
+                const auto tree = database.getRevisionTree ("conflict-1");
+                const auto loser = findNode (tree, "2-bbbb");
+                const auto tombstone = findNode (tree, {}, loser);
+
+                expect (loser >= 0 && ! tree.nodes[static_cast<size_t> (loser)].current);
+                expect (tombstone >= 0);
+
+                if (tombstone >= 0)
+                {
+                    const auto& node = tree.nodes[static_cast<size_t> (tombstone)];
+                    const auto revId = tree.getRevId (node);
+
+                    expect (node.deleted && node.current);
+                    expect (revId.size() == 42 && revId.starts_with ("3-"));
+                    expect (revId.substr (2).find_first_not_of ("0123456789abcdef") == std::string_view::npos);
+                }
+            }
+
+            beginTest ("The tombstone keeps the branch's doc_type");
+            {
+                sqlite::database check (databaseFile.getFullPathName().toStdString());
+                expect (registerExtensions (check.connection().get()));
+
+                int tombstones = 0;
+                check << "SELECT COUNT(*) FROM revs JOIN docs ON docs.doc_id = revs.doc_id"
+                         " WHERE docs.docid LIKE 'conflict-%' AND revs.deleted = 1 AND revs.current = 1 AND revs.doc_type = 'Conflicted'"
+                      >> tombstones;
+                expectEquals (tombstones, 2);
+            }
+
+            beginTest ("Resolving the same conflicts again changes nothing");
+            expectEquals (database.resolveConflicts (conflicts), 0);
+        }
+
+        /** Index of the node with the given revid, or of the first child of parent if revId is empty. */
+        static auto findNode (const RevisionTree& tree, std::string_view revId, int parent = -1) -> int
+        {
+            for (size_t i = 0; i < tree.nodes.size(); ++i)
+            {
+                const auto& node = tree.nodes[i];
+
+                if (revId.empty() ? (parent >= 0 && node.parent == parent) : tree.getRevId (node) == revId)
+                    return static_cast<int> (i);
+            }
+
+            return -1;
+        }
+
+        /** Two documents whose branches were edited independently, one with leaves of different
+            generations, and one whose second branch was already deleted, which isn't a conflict. */
+        void addConflicts()
+        {
+            sqlite::database seed (databaseFile.getFullPathName().toStdString());
+            expect (registerExtensions (seed.connection().get()));
+
+            addRevision (seed, "conflict-1", "1-aaaa", {}, false, false);
+            addRevision (seed, "conflict-1", "2-bbbb", "1-aaaa", true, false, R"({"side":"b"})");
+            addRevision (seed, "conflict-1", "2-cccc", "1-aaaa", true, false, R"({"side":"c"})");
+
+            addRevision (seed, "conflict-2", "1-aaaa", {}, false, false);
+            addRevision (seed, "conflict-2", "2-aaaa", "1-aaaa", false, false);
+            addRevision (seed, "conflict-2", "3-aaaa", "2-aaaa", true, false, R"({"side":"a"})");
+            addRevision (seed, "conflict-2", "2-ffff", "1-aaaa", true, false, R"({"side":"f"})");
+
+            addRevision (seed, "no-conflict", "1-a", {}, false, false);
+            addRevision (seed, "no-conflict", "2-a", "1-a", true, false, R"({"side":"a"})");
+            addRevision (seed, "no-conflict", "2-b", "1-a", true, true, "{}");
+        }
+
+        static void addRevision (sqlite::database& seed, const std::string& docId, const std::string& revId, const std::string& parentRevId,
+                                 bool current, bool deleted, std::string_view json = {})
+        {
+            seed << "INSERT OR IGNORE INTO docs (docid) VALUES (?)" << docId;
+            seed << "INSERT INTO revs (doc_id, revid, parent, current, deleted, json, doc_type)"
+                    " SELECT doc_id, ?, (SELECT sequence FROM revs WHERE revs.doc_id = docs.doc_id AND revid = ?), ?, ?, ?, 'Conflicted' FROM docs WHERE docid = ?"
+                 << revId << parentRevId << (current ? 1 : 0) << (deleted ? 1 : 0) << std::vector<char> (json.begin(), json.end()) << docId;
+        }
+
+        juce::File databaseFile;
+    };
+
+    static ConflictTests conflictTests;
+}
@@ -0,0 +1,93 @@
+#include <JuceHeader.h>
+#include "../Source/CouchbaseLite.h"
+#include "../Source/globaldb.h"
+#include <cstring>
+
+namespace db {
+
+    /** Reads riffs with forEachRiff from a copy of the database the tool ships with (cargo/db.sqlite3,
+        embedded through globaldb.cpp). That database only holds a few bookkeeping documents and no riffs,
+        so one is added the way Endlesss stores it, doc_type "Rifff" included. */
+    class RiffTests : public juce::UnitTest
+    {
+    public:
+        RiffTests() : juce::UnitTest ("Riff documents", "Documents") {}
+
+        void runTest() override
+        {
+            const auto folder = juce::File::createTempFile ("cblite2");
+            expect (folder.createDirectory().wasOk());
+
+            const auto databaseFile = folder.getChildFile ("db.sqlite3");
+            expect (databaseFile.replaceWithData (db_sqlite3, db_sqlite3Size));
+
+            runOn (databaseFile);
+            folder.deleteRecursively();
+        }
+
+    private:
+        void runOn (const juce::File& databaseFile)
+        {
+            beginTest ("The shipped database has no riffs");
+            {
+                CouchbaseLiteDatabase database (databaseFile);
+                expectEquals (database.forEachRiff ([] (const Riff&) { return true; }), 0);
+            }
+
+            addRiff (databaseFile);
+
+            beginTest ("forEachRiff finds Rifff documents");
+            {
+                CouchbaseLiteDatabase database (databaseFile);
+
+                std::vector<Riff> riffs;
+                const auto visited = database.forEachRiff ([&] (const Riff& riff)
+                {
+                    riffs.push_back (riff);
+                    return true;
+                });
+
+                expectGreaterOrEqual (visited, 1);
+                expectEquals (static_cast<int> (riffs.size()), visited);
+
+                if (riffs.empty())
+                    return;
+
+                const auto& riff = riffs.front();
+                expect (riff.docId == "riff-test-1");
+                expect (riff.revId == "2-b0b5");
+                expect (riff.userName == "tester");
+                expectEquals (riff.barLength, 16);
+                expectWithinAbsoluteError (riff.bps, 2.0, 1.0e-9);
+                expect (riff.slots[0].loopId == "loop-a");
+                expect (riff.slots[0].on);
+                expect (riff.slots[1].loopId == "loop-b");
+                expect (! riff.slots[1].on);
+                expect (riff.slots[2].loopId.empty());
+            }
+        }
+
+        /** Adds a riff with two revisions, so only the current one should come back. */
+        void addRiff (const juce::File& databaseFile)
+        {
+            sqlite::database seed (databaseFile.getFullPathName().toStdString());
+            expect (registerExtensions (seed.connection().get()));
+
+            static constexpr auto json = R"({"type":"Rifff","created":1717113600000,"userName":"tester","app_version":4000,)"
+                                         R"("root":2,"scale":1,"magnitude":0.5,"state":{"bps":2.0,"barLength":16,"playback":[)"
+                                         R"({"slot":{"current":{"currentLoop":"loop-a","gain":0.8,"on":true}}},)"
+                                         R"({"slot":{"current":{"currentLoop":"loop-b","gain":0.5,"on":false}}}]}})";
+
+            seed << "INSERT INTO docs (docid) VALUES ('riff-test-1')";
+            const auto docId = seed.last_insert_rowid();
+
+            seed << "INSERT INTO revs (doc_id, revid, current, deleted, json, doc_type) VALUES (?, '1-a0a0', 0, 0, NULL, 'Rifff')" << docId;
+            const auto parent = seed.last_insert_rowid();
+
+            seed << "INSERT INTO revs (doc_id, revid, parent, current, deleted, json, doc_type) VALUES (?, '2-b0b5', ?, 1, 0, ?, 'Rifff')"
+                 << docId << parent << std::vector<char> (json, json + std::strlen (json));
+        }
+    };
+
+    static RiffTests riffTests;
+}
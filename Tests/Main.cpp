@@ -0,0 +1,27 @@
+/*
+  ==============================================================================
+
+    Runs every juce::UnitTest linked into the test app and exits with 1 if any
+    of them failed. Pass a category name to run only the tests in it.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+int main (int argc, char* argv[])
+{
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure (false);
+
+    if (argc > 1)
+        runner.runTestsInCategory (argv[1]);
+    else
+        runner.runAllTests();
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        if (runner.getResult (i)->failures > 0)
+            return 1;
+
+    return 0;
+}
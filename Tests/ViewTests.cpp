@@ -0,0 +1,379 @@
+#include <JuceHeader.h>
+#include "../Source/CouchbaseLite.h"
+#include "../Source/globaldb.h"
+
+namespace db {
+
+    /** Indexes native views over a copy of the database the tool ships with (see RiffTests), editing
+        documents in between through a connection of their own, the way a replicator would. Only
+        documents of type "ViewTest" emit anything, so the ones the database ships with stay out of it. */
+    class ViewTests : public juce::UnitTest
+    {
+    public:
+        ViewTests() : juce::UnitTest ("Native views", "Views") {}
+
+        void runTest() override
+        {
+            const auto folder = juce::File::createTempFile ("cblite2");
+            expect (folder.createDirectory().wasOk());
+
+            databaseFile = folder.getChildFile ("db.sqlite3");
+            expect (databaseFile.replaceWithData (db_sqlite3, db_sqlite3Size));
+
+            {
+                CouchbaseLiteDatabase database (databaseFile);
+                database.registerView (byNumber, "1", mapByNumber);
+
+                testIncrementalUpdates (database);
+                testRebuild (database);
+                testQueries (database);
+                testReduceCache (database);
+                testFullTextSearch (database);
+                testBoundingBoxes (database);
+            }
+
+            folder.deleteRecursively();
+        }
+
+    private:
+        static constexpr auto byNumber = "test/byNumber";
+        static constexpr auto byTitle = "test/byTitle";
+        static constexpr auto byBox = "test/byBox";
+
+        static void mapByNumber (const juce::var& document, ViewEmitter& emitter)
+        {
+            if (document["type"] == "ViewTest")
+                emitter.emit (document["n"], document["n"]);
+        }
+
+        static void mapByTitle (const juce::var& document, ViewEmitter& emitter)
+        {
+            if (document["type"] == "ViewTest")
+                emitter.emitText (document["title"].toString());
+        }
+
+        /** A unit square with its top left corner at (n, n). */
+        static void mapByBox (const juce::var& document, ViewEmitter& emitter)
+        {
+            if (document["type"] == "ViewTest")
+                emitter.emitBoundingBox ({ static_cast<double> (document["n"]), static_cast<double> (document["n"]), 1.0, 1.0 }, document["title"]);
+        }
+
+        void testIncrementalUpdates (CouchbaseLiteDatabase& database)
+        {
+            beginTest ("updateView maps new documents");
+            {
+                putRevision ("view-a", "1-a1", 1, "late night drums");
+                putRevision ("view-b", "1-b1", 2, "morning bass");
+                putRevision ("view-c", "1-c1", 3, "night jam session");
+
+                const auto stats = database.updateView (byNumber);
+                expectEquals<juce::int64> (stats.rowsEmitted, 3);
+                expectEquals (getKeys (database, byNumber), juce::String ("1,2,3"));
+            }
+
+            beginTest ("updateView only maps the documents that changed, and drops their old rows");
+            {
+                putRevision ("view-b", "2-b2", 5, "morning bass");
+                deleteDocument ("view-c", "2-c2");
+
+                const auto stats = database.updateView (byNumber);
+                expectEquals<juce::int64> (stats.documentsMapped, 1);
+                expectEquals<juce::int64> (stats.rowsEmitted, 1);
+                expectEquals<juce::int64> (stats.rowsDeleted, 2);
+                expectEquals (getKeys (database, byNumber), juce::String ("1,5"));
+                expectEquals (getRows (database, byNumber)[1], juce::String ("view-b 5 5"));
+            }
+
+            beginTest ("updateView does nothing when nothing changed");
+            {
+                const auto stats = database.updateView (byNumber);
+                expectEquals<juce::int64> (stats.documentsMapped, 0);
+                expectEquals<juce::int64> (stats.rowsDeleted, 0);
+            }
+        }
+
+        void testRebuild (CouchbaseLiteDatabase& database)
+        {
+            beginTest ("rebuildView leaves the same rows as updateView");
+            {
+                const auto updated = getRows (database, byNumber);
+                const auto stats = database.rebuildView (byNumber, 2);
+
+                expectEquals (stats.threads, 2);
+                expectEquals<juce::int64> (stats.rowsEmitted, updated.size());
+                expect (getRows (database, byNumber) == updated);
+            }
+
+            beginTest ("updateView picks up where rebuildView left off");
+            {
+                putRevision ("view-d", "1-d1", 2, "evening keys");
+
+                const auto stats = database.updateView (byNumber);
+                expectEquals<juce::int64> (stats.documentsMapped, 1);
+                expectEquals (getKeys (database, byNumber), juce::String ("1,2,5"));
+            }
+        }
+
+        void testQueries (CouchbaseLiteDatabase& database)
+        {
+            putRevision ("view-e", "1-e1", 3, "night drive");
+            putRevision ("view-f", "1-f1", 4, "late night drums");
+
+            beginTest ("queryView returns rows in key order, bringing the view up to date first");
+            expectEquals (getKeys (database, byNumber), juce::String ("1,2,3,4,5"));
+
+            beginTest ("queryView limits rows to a key range");
+            {
+                ViewQueryOptions options;
+                options.startKey = 2;
+                options.endKey = 4;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("2,3,4"));
+
+                options.inclusiveEnd = false;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("2,3"));
+
+                options.startKey.reset();
+                expectEquals (getKeys (database, byNumber, options), juce::String ("1,2,3"));
+            }
+
+            beginTest ("queryView reads a range backwards with descending");
+            {
+                ViewQueryOptions options;
+                options.descending = true;
+                options.startKey = 4;
+                options.endKey = 2;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("4,3,2"));
+
+                options.inclusiveEnd = false;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("4,3"));
+            }
+
+            beginTest ("queryView skips and limits rows");
+            {
+                ViewQueryOptions options;
+                options.skip = 1;
+                options.limit = 2;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("2,3"));
+
+                options.descending = true;
+                expectEquals (getKeys (database, byNumber, options), juce::String ("4,3"));
+
+                options.skip = 10;
+                expectEquals (getKeys (database, byNumber, options), juce::String());
+            }
+
+            beginTest ("queryView returns the rows for a list of keys in that order");
+            {
+                ViewQueryOptions options;
+                options.keys = { 5, 7, 1 };
+                expectEquals (getKeys (database, byNumber, options), juce::String ("5,1"));
+                expectEquals (getRows (database, byNumber, options)[0], juce::String ("view-b 5 5"));
+            }
+        }
+
+        void testReduceCache (CouchbaseLiteDatabase& database)
+        {
+            using Reducer = ViewQueryOptions::Reducer;
+
+            beginTest ("Reduced queries count and sum the rows");
+            expectEquals (static_cast<int> (reduce (database, Reducer::count, false)), 5);
+            expectWithinAbsoluteError (static_cast<double> (reduce (database, Reducer::sum, false)), 15.0, 1.0e-9);
+
+            beginTest ("The reduce cache gives the same totals as a pass over the rows");
+            expectEquals (static_cast<int> (reduce (database, Reducer::count, true)), 5);
+            expectWithinAbsoluteError (static_cast<double> (reduce (database, Reducer::sum, true)), 15.0, 1.0e-9);
+            expect (getGroups (database, true) == getGroups (database, false));
+
+            beginTest ("The reduce cache stays current as documents are added, edited and deleted");
+            {
+                putRevision ("view-g", "1-g1", 6, "drum loop");
+                putRevision ("view-h", "1-h1", 7, "bass drop");
+                putRevision ("view-e", "2-e2", 2, "night drive");
+                deleteDocument ("view-a", "2-a2");
+
+                expectEquals (static_cast<int> (reduce (database, Reducer::count, true)), 6);
+                expectWithinAbsoluteError (static_cast<double> (reduce (database, Reducer::sum, true)), 26.0, 1.0e-9);
+
+                const auto stats = reduce (database, Reducer::stats, true);
+                expectWithinAbsoluteError (static_cast<double> (stats["min"]), 2.0, 1.0e-9);
+                expectWithinAbsoluteError (static_cast<double> (stats["max"]), 7.0, 1.0e-9);
+
+                const auto groups = getGroups (database, true);
+                expect (groups == getGroups (database, false));
+                expectEquals (groups.size(), 5);
+                expectEquals (groups[0], juce::String (" 2 2"));
+            }
+        }
+
+        void testFullTextSearch (CouchbaseLiteDatabase& database)
+        {
+            database.registerView (byTitle, "1", mapByTitle);
+
+            if (! database.hasFullTextSearch())
+            {
+                beginTest ("searchText throws without FTS5");
+
+                bool threw = false;
+                try { database.searchText (byTitle, "night"); }
+                catch (const std::runtime_error&) { threw = true; }
+
+                expect (threw);
+                return;
+            }
+
+            beginTest ("searchText finds documents by the text they emitted");
+            expectEquals (search (database, "night"), juce::String ("view-e,view-f"));
+            expectEquals (search (database, "bass"), juce::String ("view-b,view-h"));
+            expectEquals (search (database, "drum*"), juce::String ("view-f,view-g"));
+            expectEquals (search (database, "\"late night\""), juce::String ("view-f"));
+            expectEquals (database.searchText (byTitle, "bass", 1).size(), 1);
+
+            beginTest ("searchText follows edits and deletions");
+            {
+                putRevision ("view-f", "2-f2", 4, "early morning drums");
+                deleteDocument ("view-e", "3-e3");
+
+                expectEquals (search (database, "night"), juce::String());
+                expectEquals (search (database, "morning"), juce::String ("view-b,view-f"));
+            }
+        }
+
+        void testBoundingBoxes (CouchbaseLiteDatabase& database)
+        {
+            database.registerView (byBox, "1", mapByBox);
+
+            if (! database.hasSpatialIndex())
+            {
+                beginTest ("queryBoundingBox throws without R*Tree");
+
+                bool threw = false;
+                try { database.queryBoundingBox (byBox, { 0.0, 0.0, 10.0, 10.0 }); }
+                catch (const std::runtime_error&) { threw = true; }
+
+                expect (threw);
+                return;
+            }
+
+            beginTest ("queryBoundingBox finds the boxes overlapping an area");
+            {
+                expectEquals (findBoxes (database, { 2.5, 2.5, 2.0, 2.0 }), juce::String ("view-d,view-f"));
+                expectEquals (findBoxes (database, { 100.0, 100.0, 1.0, 1.0 }), juce::String());
+                expectEquals (static_cast<int> (database.queryBoundingBox (byBox, { 0.0, 0.0, 10.0, 10.0 }, 2).size()), 2);
+            }
+
+            beginTest ("queryBoundingBox includes boxes that only touch the area");
+            {
+                const auto rows = database.queryBoundingBox (byBox, { 8.0, 8.0, 1.0, 1.0 });
+                expectEquals (static_cast<int> (rows.size()), 1);
+
+                if (! rows.empty())
+                {
+                    expectEquals (rows[0].docId, juce::String ("view-h"));
+                    expect (rows[0].bounds == juce::Rectangle<double> (7.0, 7.0, 1.0, 1.0));
+                    expectEquals (rows[0].value.toString(), juce::String ("bass drop"));
+                }
+            }
+
+            beginTest ("queryBoundingBox follows edits and deletions");
+            {
+                putRevision ("view-d", "2-d2", 10, "evening keys");
+                deleteDocument ("view-f", "3-f3");
+
+                expectEquals (findBoxes (database, { 2.5, 2.5, 2.0, 2.0 }), juce::String());
+                expectEquals (findBoxes (database, { 10.5, 10.5, 0.0, 0.0 }), juce::String ("view-d"));
+            }
+        }
+
+        /** The IDs of the documents with a box overlapping the area, sorted. */
+        static auto findBoxes (CouchbaseLiteDatabase& database, juce::Rectangle<double> area) -> juce::String
+        {
+            juce::StringArray docIds;
+
+            for (const auto& row : database.queryBoundingBox (byBox, area))
+                docIds.add (row.docId);
+
+            docIds.sort (false);
+            return docIds.joinIntoString (",");
+        }
+
+        /** The IDs of the documents matching a full-text query, sorted. */
+        static auto search (CouchbaseLiteDatabase& database, const juce::String& query) -> juce::String
+        {
+            auto docIds = database.searchText (byTitle, query);
+            docIds.sort (false);
+            return docIds.joinIntoString (",");
+        }
+
+        /** The single value of a query reduced over the whole view. */
+        static auto reduce (CouchbaseLiteDatabase& database, ViewQueryOptions::Reducer reducer, bool cached) -> juce::var
+        {
+            ViewQueryOptions options;
+            options.reduce = reducer;
+            options.cached = cached;
+
+            auto cursor = database.queryView (byNumber, options);
+            return cursor.next() ? cursor.getValue() : juce::var();
+        }
+
+        /** The view counted per key, as getRows lists the groups. */
+        static auto getGroups (CouchbaseLiteDatabase& database, bool cached) -> juce::StringArray
+        {
+            ViewQueryOptions options;
+            options.reduce = ViewQueryOptions::Reducer::count;
+            options.group = true;
+            options.cached = cached;
+            return getRows (database, byNumber, options);
+        }
+
+        /** Each row a query returns as "docId key value", in the order it comes back. */
+        static auto getRows (CouchbaseLiteDatabase& database, const juce::String& view, const ViewQueryOptions& options = {}) -> juce::StringArray
+        {
+            juce::StringArray rows;
+            auto cursor = database.queryView (view, options);
+
+            while (cursor.next())
+                rows.add (cursor.getDocId() + " " + juce::JSON::toString (cursor.getKey(), true) + " " + juce::JSON::toString (cursor.getValue(), true));
+
+            return rows;
+        }
+
+        /** The keys a query returns as JSON, separated by commas. */
+        static auto getKeys (CouchbaseLiteDatabase& database, const juce::String& view, const ViewQueryOptions& options = {}) -> juce::String
+        {
+            juce::StringArray keys;
+            auto cursor = database.queryView (view, options);
+
+            while (cursor.next())
+                keys.add (juce::JSON::toString (cursor.getKey(), true));
+
+            return keys.joinIntoString (",");
+        }
+
+        /** Adds a revision to a document, creating it if need be, and makes it the only current one. */
+        void putRevision (const juce::String& docId, const juce::String& revId, int n, const juce::String& title, bool deleted = false)
+        {
+            sqlite::database seed (databaseFile.getFullPathName().toStdString());
+            expect (registerExtensions (seed.connection().get()));
+
+            const auto json = deleted ? juce::String ("{}")
+                                      : "{\"type\":\"ViewTest\",\"n\":" + juce::String (n) + ",\"title\":" + juce::JSON::toString (title) + "}";
+            const auto body = json.toStdString();
+
+            seed << "INSERT OR IGNORE INTO docs (docid) VALUES (?)" << docId.toStdString();
+            seed << "UPDATE revs SET current = 0 WHERE current = 1 AND doc_id = (SELECT doc_id FROM docs WHERE docid = ?)" << docId.toStdString();
+            seed << "INSERT INTO revs (doc_id, revid, parent, current, deleted, json, doc_type)"
+                    " SELECT doc_id, ?, (SELECT MAX(sequence) FROM revs WHERE revs.doc_id = docs.doc_id), 1, ?, ?, 'ViewTest' FROM docs WHERE docid = ?"
+                 << revId.toStdString() << (deleted ? 1 : 0) << std::vector<char> (body.begin(), body.end()) << docId.toStdString();
+        }
+
+        void deleteDocument (const juce::String& docId, const juce::String& revId)
+        {
+            putRevision (docId, revId, 0, {}, true);
+        }
+
+        juce::File databaseFile;
+    };
+
+    static ViewTests viewTests;
+}